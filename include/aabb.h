@@ -0,0 +1,77 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "commons.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Axis aligned bounding box, empty (min > max) when default constructed
+struct Aabb {
+  Vertex min;
+  Vertex max;
+
+  Aabb() : min(FLT_MAX, FLT_MAX, FLT_MAX), max(-FLT_MAX, -FLT_MAX, -FLT_MAX) {}
+  Aabb(Vertex min, Vertex max) : min(min), max(max) {}
+
+  bool IsEmpty() const { return min.x > max.x; }
+  Vertex Centroid() const { return (min + max) * 0.5f; }
+
+  void Extend(Vertex point) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+  }
+
+  void Extend(const Aabb& box) {
+    min = glm::min(min, box.min);
+    max = glm::max(max, box.max);
+  }
+
+  float SurfaceArea() const {
+    if (IsEmpty()) {
+      return 0.f;
+    }
+    Direction extent = max - min;
+    return 2.f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+  }
+
+  int LongestAxis() const {
+    Direction extent = max - min;
+    return extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+  }
+
+  // Slab test, t_near is where the ray enters the box (0 if inside)
+  bool IntersectRay(Vertex origin, Direction inverse_direction, float t_max, float& t_near) const {
+    Direction t0 = (min - origin) * inverse_direction;
+    Direction t1 = (max - origin) * inverse_direction;
+    Direction t_small = glm::min(t0, t1);
+    Direction t_big = glm::max(t0, t1);
+    t_near = std::max(std::max(t_small.x, t_small.y), std::max(t_small.z, 0.f));
+    float t_far = std::min(std::min(t_big.x, t_big.y), std::min(t_big.z, t_max));
+    return t_near <= t_far;
+  }
+
+  // Bounds of the transformed box
+  Aabb Transform(const glm::mat4& transform) const {
+    Aabb box;
+    for (int corner = 0; corner < 8; corner++) {
+      glm::vec4 p = glm::vec4(corner & 1 ? max.x : min.x, corner & 2 ? max.y : min.y,
+                              corner & 4 ? max.z : min.z, 1.f);
+      box.Extend(Vertex(transform * p));
+    }
+    return box;
+  }
+};
+
+// 1 / direction for Aabb::IntersectRay(), kept finite: a ray parallel to an
+// axis that starts on a slab plane would get 0 * inf = NaN and miss the box
+inline Direction InverseDirection(Direction direction) {
+  Direction inverse_direction;
+  for (int axis = 0; axis < 3; axis++) {
+    inverse_direction[axis] = std::abs(direction[axis]) > 1e-20f ? 1.f / direction[axis]
+                                                                  : (direction[axis] < 0.f ? -1e20f : 1e20f);
+  }
+  return inverse_direction;
+}
+
+#endif // AABB_H
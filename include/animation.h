@@ -0,0 +1,31 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "commons.h"
+#include <vector>
+
+struct Keyframe {
+  float time;
+  Direction translation;
+  float rotation; // radians around the z axis, i.e. a turntable
+  float scale;
+};
+
+/**
+  Rigid motion of one object relative to where it was created, linearly
+  interpolated between keyframes and held before the first and after the
+  last one. Rotation and scaling are around pivot.
+*/
+class Animation {
+private:
+  Vertex pivot_;
+  std::vector<Keyframe> keyframes_; // sorted by time
+
+public:
+  explicit Animation(Vertex pivot) : pivot_(pivot) {}
+
+  void AddKeyframe(float time, Direction translation, float rotation, float scale);
+  glm::mat4 Evaluate(float time) const;
+};
+
+#endif // ANIMATION_H
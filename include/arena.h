@@ -0,0 +1,66 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+  Bump allocator. Memory comes from large blocks and is only given back all
+  at once, by Reset() or when the arena is destroyed. Objects created with
+  Create() have their destructors run at that point, in reverse order.
+
+  Not thread safe, every thread needs its own arena.
+*/
+class Arena {
+private:
+  struct Block {
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+  struct Destructor {
+    void (*destroy)(void*);
+    void* object;
+  };
+
+  std::vector<Block> blocks_;
+  std::vector<Destructor> destructors_;
+  size_t block_size_;
+  size_t block_index_; // block that is allocated from
+  size_t offset_;      // first free byte in that block
+
+  void RunDestructors();
+
+public:
+  explicit Arena(size_t block_size = 64 * 1024);
+  ~Arena();
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+  Arena(Arena&&) = default;
+  Arena& operator=(Arena&&) = default;
+
+  void* Allocate(size_t size, size_t alignment);
+
+  template <typename T, typename... Args>
+  T* Create(Args&&... args) {
+    T* object = new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value) {
+      Destructor destructor;
+      destructor.destroy = [](void* p) { static_cast<T*>(p)->~T(); };
+      destructor.object = object;
+      destructors_.push_back(destructor);
+    }
+    return object;
+  }
+
+  // Destroys everything but keeps the blocks, so an arena that is reset
+  // over and over stops calling malloc after the first few rounds
+  void Reset();
+
+  size_t get_capacity() const;
+};
+
+#endif // ARENA_H
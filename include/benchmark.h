@@ -0,0 +1,29 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+/**
+  Measurements of the building blocks of the renderer, run with --benchmark
+  instead of rendering an image.
+*/
+class Benchmark {
+public:
+  static void Run();
+
+  // Node memory and single threaded closest hit speed of the binary and the
+  // compressed BVH on a procedural height field
+  static void RunBvh(int triangle_count, int ray_count);
+  // Closest hit speed of particle-like spheres, once as separate scene
+  // objects and once as a SphereSet with the scalar and the AVX2 kernel
+  static void RunSpheres(int sphere_count, int ray_count);
+  // Build time and closest hit speed of the BVH and the uniform grid over
+  // separate spheres, spread evenly and in clumps, and which of the two
+  // Scene::PreferGrid() picks for each
+  static void RunGrid(int sphere_count, int ray_count);
+  // Seconds the ray tracing and the bidirectional integrator need to get
+  // below a few error levels on a small image of the room, giving up after
+  // max_seconds. The two do not converge to the same image, so each is
+  // compared to its own reference
+  static void RunIntegrators(int size, int reference_spp, double max_seconds);
+};
+
+#endif // BENCHMARK_H
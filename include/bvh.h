@@ -0,0 +1,119 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "aabb.h"
+#include <cassert>
+#include <vector>
+
+// Nodes on the path from the root to a leaf at most. Near the limit the
+// build only makes median splits, so degenerate SAH splits cannot overflow
+// the traversal stacks
+const int BVH_MAX_DEPTH = 64;
+
+// 32 bytes. Children of inner nodes are stored next to each other, so one
+// index is enough for both of them
+struct BvhNode {
+  Aabb bounds;
+  int left_first; // left child of inner nodes, first primitive of leaves
+  int count;      // primitives in a leaf, 0 for inner nodes
+};
+
+/**
+  Binary bounding volume hierarchy over anything that has bounds, built with
+  a binned surface area heuristic. Nodes and primitive indices live in two
+  flat arrays. Leaves hold at most 8 primitives.
+*/
+class Bvh {
+private:
+  std::vector<BvhNode> nodes_;
+  std::vector<int> indices_;
+  // Nodes of every depth, to refit the tree bottom up one level at a time
+  std::vector<std::vector<int>> levels_;
+
+  void UpdateNodeBounds(int node, const std::vector<Aabb>& primitive_bounds);
+  void Subdivide(int node, int depth, const std::vector<Aabb>& primitive_bounds);
+
+public:
+  void Build(const std::vector<Aabb>& primitive_bounds);
+  // Updates the bounds after primitives have moved but keeps the topology,
+  // which gets slower to trace the further they move
+  void Refit(const std::vector<Aabb>& primitive_bounds);
+  // Expected cost of tracing a ray according to the surface area heuristic,
+  // in units of one primitive test
+  float ComputeSahCost() const;
+
+  bool IsEmpty() const { return nodes_.empty(); }
+  Aabb get_bounds() const { return nodes_.empty() ? Aabb() : nodes_[0].bounds; }
+  const std::vector<BvhNode>& get_nodes() const { return nodes_; }
+  const std::vector<int>& get_indices() const { return indices_; }
+  size_t GetNodeMemory() const { return nodes_.size() * sizeof(BvhNode); }
+
+  // Visits the leaves hit by the ray front to back and calls
+  // intersect(primitive, t_max) for their primitives. intersect() may lower
+  // t_max to cull farther nodes and returns true to stop the traversal.
+  template <typename IntersectPrimitive>
+  void Traverse(Vertex origin, Direction direction, float& t_max, IntersectPrimitive intersect) const;
+};
+
+template <typename IntersectPrimitive>
+void Bvh::Traverse(Vertex origin, Direction direction, float& t_max, IntersectPrimitive intersect) const {
+  if (nodes_.empty()) {
+    return;
+  }
+  Direction inverse_direction = InverseDirection(direction);
+  float t_near;
+  if (!nodes_[0].bounds.IntersectRay(origin, inverse_direction, t_max, t_near)) {
+    return;
+  }
+  // One entry per level at most
+  struct StackEntry {
+    int node;
+    float t_near;
+  } stack[BVH_MAX_DEPTH];
+  int stack_size = 0;
+  int node = 0;
+  while (true) {
+    const BvhNode& current = nodes_[node];
+    bool descend = false;
+    if (current.count > 0) {
+      for (int i = 0; i < current.count; i++) {
+        if (intersect(indices_[current.left_first + i], t_max)) {
+          return;
+        }
+      }
+    } else {
+      int left = current.left_first;
+      int right = left + 1;
+      float t_left, t_right;
+      bool hit_left = nodes_[left].bounds.IntersectRay(origin, inverse_direction, t_max, t_left);
+      bool hit_right = nodes_[right].bounds.IntersectRay(origin, inverse_direction, t_max, t_right);
+      if (hit_left && hit_right) {
+        if (t_right < t_left) {
+          std::swap(left, right);
+          std::swap(t_left, t_right);
+        }
+        assert(stack_size < BVH_MAX_DEPTH);
+        stack[stack_size].node = right;
+        stack[stack_size].t_near = t_right;
+        stack_size++;
+      }
+      if (hit_left || hit_right) {
+        node = hit_left ? left : right;
+        descend = true;
+      }
+    }
+    if (descend) {
+      continue;
+    }
+    // Skip nodes that are behind the closest hit found since they were pushed
+    do {
+      if (stack_size == 0) {
+        return;
+      }
+      stack_size--;
+    } while (stack[stack_size].t_near > t_max);
+    node = stack[stack_size].node;
+  }
+}
+
+#endif // BVH_H
@@ -7,7 +7,9 @@
 #include <vector>
 #include "commons.h"
 #include <memory>
+#include <functional>
 #include "pixel.h"
+#include "checkpoint.h"
 
 /**
   Warning: Stack size is OS-dependent and max is 8182 kb on Ubuntu 64
@@ -21,9 +23,17 @@
 #define HEIGHT 1000
 
 typedef std::vector<std::vector<std::vector<int>>> ImageRgb;
-typedef std::vector<std::vector<Pixel>> Framebuffer;
+
+// How a camera ray becomes a color
+enum Integrator {
+  INTEGRATOR_RAYTRACE, // Raytracer::Raytrace()
+  INTEGRATOR_BIDIRECTIONAL, // Raytracer::TraceBidirectional()
+};
 
 class Scene;
+class Raytracer;
+class IrradianceCache;
+class PhotonMap;
 
 class Camera {
 private:
@@ -35,11 +45,50 @@ private:
 
   float delta_;
   float pixel_center_minimum_;
+  float pixel_center_minimum_z_;
   int pos_idx_; // determines which eye_pos_ we are using
+  int width_;
+  int height_;
+
+  unsigned int seed_;
+  int first_sample_;
+  int samples_rendered_; // index of the next sample to render in every pixel
+  int tile_partition_index_;
+  int tile_partition_count_;
+  int merged_spp_; // of the whole render if this is a part of it, else 0
+  std::string checkpoint_path_;
+  double checkpoint_interval_; // seconds
+  bool use_irradiance_cache_;
+  int caustic_photons_;
+  bool numa_pinning_;
+  // Scene copies of the NUMA nodes, kept between renders while the scene
+  // still has the version they were copied at
+  std::vector<std::unique_ptr<Scene>> numa_replicas_;
+  int numa_replica_version_;
+  Integrator integrator_;
+  std::function<void(double)> progress_callback_;
+
+  struct TileCost {
+    double seconds = 0.; // wall time of the thread that rendered it
+    long long rays = 0;
+  };
+  std::vector<TileCost> tile_costs_; // since ClearColorBuffer()
+  // Of the last render: building the photon map, irradiance cache and
+  // NUMA replicas, and rendering all its passes
+  double setup_seconds_;
+  double pass_seconds_;
 
   // float focal_length_;
   // float fov_; // field of view
-  Framebuffer framebuffer_;
+  Framebuffer framebuffer_; // belongs to eye_pos_[pos_idx_]
+  Framebuffer other_eye_framebuffer_;
+
+  struct FirstHit {
+    Vertex position;
+    bool reusable; // diffuse, so its samples hold from any eye position
+  };
+  // Of the pixel centers seen from eye_pos_[pos_idx_], filled by MoveEye()
+  std::vector<FirstHit> first_hits_;
 
   //TODO: implement a PROPER Z-buffer ;p
   // float zbuffer_[WIDTH][HEIGHT];
@@ -52,14 +101,31 @@ private:
   void NormalizeByMaxIntensity(ImageRgb& image_rgb);
   void NormalizeBySqrt(ImageRgb& image_rgb);
 
-  static void SaveImage(const char* img_name, ImageRgb& image);
+  static bool SaveImage(const char* img_name, ImageRgb& image);
+
+  ColorDbl RenderSample(Raytracer& raytracer, Scene& scene, int eye, int x, int y, int sample);
+  void RenderTile(Raytracer& raytracer, Scene& scene, int tile, int sample, bool stereo);
+  void RenderPasses(Scene& scene, int spp, bool stereo);
+  void ReportProgress(long long done, long long total);
+  void FindFirstHits(Scene& scene, Vertex eye, std::vector<FirstHit>& hits);
+  // Pixel whose center ray from eye passes closest to position
+  bool ProjectToPixel(Vertex eye, Vertex position, int& x, int& y);
+  std::unique_ptr<IrradianceCache> BuildIrradianceCache(Scene& scene, bool stereo,
+                                                        const PhotonMap* caustic_map);
+  std::unique_ptr<Checkpoint> CreateCheckpoint(int target_spp);
+  void AddCheckpoint(Checkpoint& checkpoint);
 
  public:
   Camera();
-  Camera(Vertex eye_pos1, Vertex eye_pos2, Direction direction, Direction up_vector);
-
-  int get_width() { return WIDTH; }
-  int get_height() { return HEIGHT; }
+  Camera(Vertex eye_pos1, Vertex eye_pos2, Direction direction, Direction up_vector,
+         int width = WIDTH, int height = HEIGHT);
+  // Defined where Scene is complete, for the NUMA replicas
+  ~Camera();
+  Camera(Camera&& other);
+  Camera& operator=(Camera&& other);
+
+  int get_width() { return width_; }
+  int get_height() { return height_; }
   //TODO: clean this up (or implement it?)
   // float get_fov() { return fov_; }
   // float get_focal_length() { return focal_length_; }
@@ -72,10 +138,73 @@ private:
   // void set_position(Vertex pos) { eye = pos; }
   // void set_direction(glm::vec3 dir) { direction_ = dir; }
   // void set_up_vector(glm::vec3 up_vec) { up_vector_ = up_vec; }
+  int get_samples_rendered() { return samples_rendered_; }
+  ColorDbl get_pixel_color(int x, int y) { return framebuffer_[x][y].get_color(); }
+  void set_seed(unsigned int seed) { seed_ = seed; }
+
+  // Distributed rendering: a worker either starts at its own first sample so
+  // the sample ranges of all workers are disjoint, or only renders the tiles
+  // where tile % count == index. Either way its buffer is partial, even when
+  // its range starts at sample 0, and merged_spp is the samples/pixel of the
+  // whole render
+  void set_first_sample(int first_sample) { first_sample_ = samples_rendered_ = first_sample; }
+  void set_tile_partition(int index, int count);
+  void set_partial_render(int merged_spp) { merged_spp_ = merged_spp; }
+  bool IsPartialRender() { return merged_spp_ > 0; }
+
+  // Also switches framebuffer, every eye position has its own
   void ChangeEyePos();
+  Vertex get_eye_pos() { return eye_pos_[pos_idx_]; }
+  // Moves the current eye and keeps the samples of every pixel that still
+  // sees the surface one of the old pixels saw, found by reprojecting the
+  // first hits of the pixel centers. Only diffuse hits are reused, and at
+  // most a few samples of each so that reprojection errors fade out.
+  // Returns the fraction of pixels that kept samples
+  float MoveEye(Scene& scene, Vertex eye_pos);
+  // Adds spp samples to every pixel, ClearColorBuffer() starts over
   void Render(Scene& scene, int spp = 1);
+  // Renders both eye positions in one pass, sharing the tile scheduling and
+  // the random sequences of every sample. Not checkpointed.
+  void RenderStereo(Scene& scene, int spp = 1);
+  // The bidirectional integrator finds caustics and indirect light itself,
+  // and ignores the irradiance cache and caustic photons
+  void set_integrator(Integrator integrator) { integrator_ = integrator; }
+  // Builds an irradiance cache before rendering and interpolates the
+  // indirect light of first diffuse hits from it. In stereo renders both
+  // eyes share the same cache.
+  void EnableIrradianceCache(bool enable) { use_irradiance_cache_ = enable; }
+  // Traces photon_count photons from the lights before rendering and adds
+  // the caustics they form to the direct light, 0 disables caustics
+  void EnableCausticPhotons(int photon_count) { caustic_photons_ = photon_count; }
+  // Pins one render thread to every CPU and gives each NUMA node its own
+  // copy of the scene, its own share of the tiles and the framebuffer
+  // columns of those tiles in its local memory
+  void EnableNumaPinning(bool enable) { numa_pinning_ = enable; }
+  // Receives the finished fraction of every render instead of the progress
+  // printout, one call at a time
+  void set_progress_callback(std::function<void(double)> callback) { progress_callback_ = callback; }
+  // Renders pilot_spp samples/pixel and predicts from how long they took
+  // how long rendering spp samples/pixel would take, in seconds. The pilot
+  // samples stay in the framebuffer
+  double EstimateRenderTime(Scene& scene, int spp, int pilot_spp, bool stereo = false);
+  // Writes the time spent in every tile as a heatmap .ppm, and the time and
+  // rays of every tile as .csv. Returns the path of the .csv, empty if
+  // either could not be written
+  std::string CreateCostMap(std::string filename);
+  // Periodically saves the accumulation buffer during Render()
+  void EnableCheckpoints(std::string path, double interval_seconds);
+  // Restores a checkpoint, returns the samples/pixel that are left to render
+  // or -1 if the checkpoint cannot be used with this camera
+  int ResumeFromCheckpoint(std::string path);
+  // Adds the samples of a (partial) render to the framebuffer. header gets
+  // everything of the checkpoint but its pixels, to check the parts match
+  bool MergePartialRender(std::string path, Checkpoint& header);
   void ClearColorBuffer(ColorDbl clear_color);
-  void CreateImage(std::string filename, const bool& normalize_intensities);
+  // Returns the path of the image, empty if it could not be written
+  std::string CreateImage(std::string filename, const bool& normalize_intensities);
+  // Writes the linear framebuffer as .pfm and .exr (with sample counts),
+  // returns the path of the .pfm or empty if either could not be written
+  std::string CreateHdrImage(std::string filename);
 };
 
 #endif // CAMERA_H
@@ -0,0 +1,68 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+  Snapshot of a render in progress: the accumulation buffer, the per-pixel
+  sample counts and everything needed to continue the random sequences.
+
+  Every sample is seeded from (seed, pixel, sample index), so the RNG state is
+  fully described by the seed and the number of samples already rendered.
+  Pixels are stored in framebuffer order (column major, like Camera).
+
+  The same format is used for the partial buffers of distributed renders,
+  where a worker only renders the samples [first_sample, samples_rendered)
+  of the tiles with tile % tile_partition_count == tile_partition_index,
+  and partial is set. merged_spp is the samples/pixel of the whole render,
+  which all parts of it share; target_spp is where this part stops. The
+  sample counts are the weights used when merging partial buffers.
+*/
+struct Checkpoint {
+  int width = 0;
+  int height = 0;
+  unsigned int seed = 0;
+  int eye_index = 0;
+  int first_sample = 0;
+  int samples_rendered = 0;
+  int target_spp = 0;
+  int tile_partition_index = 0;
+  int tile_partition_count = 1;
+  bool partial = false; // rendered by a worker, only to be merged
+  int merged_spp = 0;
+  std::vector<float> color_sums; // 3 floats per pixel
+  std::vector<unsigned int> sample_counts;
+
+  // Writes to a temporary file first and renames it, so a crash during the
+  // write never destroys the previous checkpoint
+  bool Save(const std::string& path) const;
+  static std::unique_ptr<Checkpoint> Load(const std::string& path);
+};
+
+// Writes checkpoints on a background thread so the render threads only pay
+// for copying the framebuffer
+class CheckpointWriter {
+private:
+  std::string path_;
+  std::unique_ptr<Checkpoint> pending_;
+  bool stop_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::thread thread_;
+
+  void Run();
+
+public:
+  explicit CheckpointWriter(std::string path);
+  ~CheckpointWriter(); // finishes writing whatever is still pending
+
+  // Replaces any checkpoint that has not been written yet
+  void Submit(std::unique_ptr<Checkpoint> checkpoint);
+};
+
+#endif // CHECKPOINT_H
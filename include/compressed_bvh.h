@@ -0,0 +1,107 @@
+#ifndef COMPRESSED_BVH_H
+#define COMPRESSED_BVH_H
+
+#include "bvh.h"
+#include <stdint.h>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+// 64 bytes, i.e. one cache line. Child boxes are stored in steps of scale
+// from origin, rounded outwards so they always contain the real box
+struct CompressedBvhNode {
+  float origin[3];
+  float scale[3];
+  uint8_t lower[3][4]; // [axis][child]
+  uint8_t upper[3][4];
+  int children[4]; // inner node index, ~(first << 3 | (count - 1)) for leaves, 0 if unused
+};
+
+/**
+  Four wide BVH with 8 bit child bounds, made by collapsing a binary Bvh.
+  Takes about half the node memory of the binary tree and tests all
+  four children of a node at once (with SSE2 where available).
+*/
+class CompressedBvh {
+private:
+  std::unique_ptr<char[]> storage_;
+  CompressedBvhNode* nodes_ = nullptr; // 64 byte aligned, inside storage_
+  int node_count_ = 0;
+  std::vector<int> indices_;
+  Aabb bounds_;
+
+  // Bit i is set if the ray hits child i closer than t_max
+  int IntersectChildren(const CompressedBvhNode& node, Vertex origin, Direction inverse_direction,
+                        float t_max, float t_near[4]) const;
+  // Copies the nodes into new aligned storage
+  void StoreNodes(const CompressedBvhNode* nodes, int node_count);
+
+public:
+  CompressedBvh() = default;
+  CompressedBvh(const CompressedBvh& other);
+  CompressedBvh& operator=(const CompressedBvh& other);
+
+  void Build(const Bvh& bvh);
+
+  Aabb get_bounds() const { return bounds_; }
+  int get_node_count() const { return node_count_; }
+  size_t GetNodeMemory() const { return node_count_ * sizeof(CompressedBvhNode); }
+
+  // Same contract as Bvh::Traverse()
+  template <typename IntersectPrimitive>
+  void Traverse(Vertex origin, Direction direction, float& t_max, IntersectPrimitive intersect) const;
+};
+
+template <typename IntersectPrimitive>
+void CompressedBvh::Traverse(Vertex origin, Direction direction, float& t_max, IntersectPrimitive intersect) const {
+  if (node_count_ == 0) {
+    return;
+  }
+  // The quantized bounds are multiplied by the inverse too
+  Direction inverse_direction = InverseDirection(direction);
+  // Every wide node collapses at least one level of the binary tree and
+  // replaces its entry by at most 4, so BVH_MAX_DEPTH bounds this
+  struct StackEntry {
+    int child;
+    float t_near;
+  } stack[3 * BVH_MAX_DEPTH + 1];
+  int stack_size = 1;
+  stack[0].child = 0;
+  stack[0].t_near = 0.f;
+  while (stack_size > 0) {
+    StackEntry entry = stack[--stack_size];
+    if (entry.t_near > t_max) {
+      continue;
+    }
+    if (entry.child < 0) {
+      int first = ~entry.child >> 3;
+      int count = (~entry.child & 7) + 1;
+      for (int i = 0; i < count; i++) {
+        if (intersect(indices_[first + i], t_max)) {
+          return;
+        }
+      }
+      continue;
+    }
+    const CompressedBvhNode& node = nodes_[entry.child];
+    float t_near[4];
+    int hits = IntersectChildren(node, origin, inverse_direction, t_max, t_near);
+    // Push the farthest child first so the closest one is visited next
+    int first = stack_size;
+    for (int i = 0; i < 4; i++) {
+      if (!(hits & (1 << i)) || node.children[i] == 0) {
+        continue;
+      }
+      assert(stack_size < 3 * BVH_MAX_DEPTH + 1);
+      int slot = stack_size++;
+      while (slot > first && stack[slot - 1].t_near < t_near[i]) {
+        stack[slot] = stack[slot - 1];
+        slot--;
+      }
+      stack[slot].child = node.children[i];
+      stack[slot].t_near = t_near[i];
+    }
+  }
+}
+
+#endif // COMPRESSED_BVH_H
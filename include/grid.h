@@ -0,0 +1,113 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include "aabb.h"
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+/**
+  Uniform grid over anything that has bounds, for many primitives of about
+  the same size spread evenly over the scene. It is built in linear time
+  (count the primitives of every cell, prefix sum, fill) and traced with a
+  3D-DDA from cell to cell, so it suits content that changes every frame.
+  A primitive is listed in every cell its bounds overlap.
+*/
+class Grid {
+private:
+  Aabb bounds_;
+  int resolution_[3];
+  Direction cell_size_;
+  // Cell c holds indices_[cell_starts_[c]] up to indices_[cell_starts_[c + 1]]
+  std::vector<int> cell_starts_;
+  std::vector<int> indices_;
+
+  // Range of cells the box overlaps, inclusive
+  void GetCellRange(const Aabb& box, int first[3], int last[3]) const;
+
+public:
+  Grid();
+
+  // cells_per_primitive sets the resolution, the cells are as close to
+  // cubes as the bounds allow
+  void Build(const std::vector<Aabb>& primitive_bounds, float cells_per_primitive = 2.f);
+
+  bool IsEmpty() const { return indices_.empty(); }
+  Aabb get_bounds() const { return bounds_; }
+  int get_cell_count() const { return resolution_[0] * resolution_[1] * resolution_[2]; }
+  // Fraction of the cells that hold at least one primitive
+  float GetOccupancy() const;
+  size_t GetMemory() const { return (cell_starts_.size() + indices_.size()) * sizeof(int); }
+
+  // Same contract as Bvh::Traverse(): calls intersect(primitive, t_max) for
+  // the primitives of the cells along the ray front to back, which may
+  // lower t_max and returns true to stop
+  template <typename IntersectPrimitive>
+  void Traverse(Vertex origin, Direction direction, float& t_max, IntersectPrimitive intersect) const;
+};
+
+// A primitive that spans several cells is only tested in the first one of
+// them the ray visits, as long as it is one of the last few tested
+const int GRID_MAILBOX_SIZE = 8;
+
+template <typename IntersectPrimitive>
+void Grid::Traverse(Vertex origin, Direction direction, float& t_max, IntersectPrimitive intersect) const {
+  if (indices_.empty()) {
+    return;
+  }
+  Direction inverse_direction = InverseDirection(direction);
+  float t_near;
+  if (!bounds_.IntersectRay(origin, inverse_direction, t_max, t_near)) {
+    return;
+  }
+  Vertex entry = origin + direction * t_near;
+  int cell[3], step[3];
+  float t_next[3], t_delta[3];
+  for (int axis = 0; axis < 3; axis++) {
+    cell[axis] = (int)((entry[axis] - bounds_.min[axis]) / cell_size_[axis]);
+    cell[axis] = std::min(std::max(cell[axis], 0), resolution_[axis] - 1);
+    if (direction[axis] > 0.f) {
+      step[axis] = 1;
+      t_next[axis] = (bounds_.min[axis] + (cell[axis] + 1) * cell_size_[axis] - origin[axis]) * inverse_direction[axis];
+      t_delta[axis] = cell_size_[axis] * inverse_direction[axis];
+    } else if (direction[axis] < 0.f) {
+      step[axis] = -1;
+      t_next[axis] = (bounds_.min[axis] + cell[axis] * cell_size_[axis] - origin[axis]) * inverse_direction[axis];
+      t_delta[axis] = -cell_size_[axis] * inverse_direction[axis];
+    } else {
+      step[axis] = 0;
+      t_next[axis] = FLT_MAX;
+      t_delta[axis] = FLT_MAX;
+    }
+  }
+
+  int mailbox[GRID_MAILBOX_SIZE];
+  std::fill(mailbox, mailbox + GRID_MAILBOX_SIZE, -1);
+  int mailbox_next = 0;
+  while (true) {
+    int c = (cell[2] * resolution_[1] + cell[1]) * resolution_[0] + cell[0];
+    for (int i = cell_starts_[c]; i < cell_starts_[c + 1]; i++) {
+      int primitive = indices_[i];
+      if (std::find(mailbox, mailbox + GRID_MAILBOX_SIZE, primitive) != mailbox + GRID_MAILBOX_SIZE) {
+        continue;
+      }
+      mailbox[mailbox_next] = primitive;
+      mailbox_next = (mailbox_next + 1) % GRID_MAILBOX_SIZE;
+      if (intersect(primitive, t_max)) {
+        return;
+      }
+    }
+    int axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+    // Every hit in the cells that follow is farther than the closest one so far
+    if (t_next[axis] > t_max) {
+      return;
+    }
+    cell[axis] += step[axis];
+    if (cell[axis] < 0 || cell[axis] >= resolution_[axis]) {
+      return;
+    }
+    t_next[axis] += t_delta[axis];
+  }
+}
+
+#endif // GRID_H
@@ -0,0 +1,25 @@
+#ifndef HDR_IMAGE_H
+#define HDR_IMAGE_H
+
+#include "pixel.h"
+
+/**
+  Writes the linear (not tone mapped) framebuffer straight to disk so renders
+  can be merged and re-tonemapped afterwards.
+
+  Both writers use the same orientation as Camera::SaveImage, i.e. the first
+  framebuffer index is the (mirrored) column and the second one is the row
+  counted from the bottom.
+*/
+class HdrImage {
+public:
+  // Portable float map, RGB mean radiance per pixel
+  static bool SavePfm(const char* img_name, Framebuffer& framebuffer);
+
+  // Uncompressed, single level tiled OpenEXR with FLOAT R, G, B channels
+  // holding the mean radiance and a UINT "samples" channel with the sample
+  // count of every pixel (mean * samples gives back the accumulated sum)
+  static bool SaveTiledExr(const char* img_name, Framebuffer& framebuffer);
+};
+
+#endif // HDR_IMAGE_H
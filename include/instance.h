@@ -0,0 +1,35 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "scene_object.h"
+#include "mesh.h"
+#include "material.h"
+
+/**
+  A mesh placed in the scene with its own transform and optionally its own
+  material. Rays are moved into the space of the mesh instead of the other
+  way around, so any number of instances can share one mesh.
+*/
+class Instance : public SceneObject {
+private:
+  const Mesh* mesh_;
+  glm::mat4 placement_; // object_to_world_ before any animation
+  glm::mat4 object_to_world_;
+  glm::mat4 world_to_object_;
+  glm::mat3 normal_to_world_;
+  bool has_material_ = false;
+  Material material_; // overrides the materials of the triangles
+
+public:
+  // mesh is not owned and has to outlive the instance
+  Instance(const Mesh* mesh, glm::mat4 object_to_world);
+  Instance(const Mesh* mesh, glm::mat4 object_to_world, Material material);
+
+  IntersectionPoint* RayIntersection(Ray& ray, Arena& arena);
+  Aabb GetBounds();
+  Instance* Clone(Arena& arena, const MeshCopies& meshes) const;
+  bool GetCausticBounds(Vertex& center, float& radius);
+  void set_transform(const glm::mat4& transform);
+};
+
+#endif // INSTANCE_H
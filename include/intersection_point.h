@@ -8,16 +8,15 @@ class IntersectionPoint {
 private:
   Vertex position_;
   Direction normal_;
-  Material material_;
+  const Material* material_; // owned by the object that was hit
   float z_;
 public:
-  IntersectionPoint();
-  IntersectionPoint(Vertex position, Direction normal, Material material_, float z);
+  IntersectionPoint(Vertex position, Direction normal, const Material* material, float z);
 
-  float get_z() { return z_; }
-  Vertex get_position() { return position_; }
-  Direction get_normal() { return normal_; }
-  Material get_material() { return material_; }
+  float get_z() const { return z_; }
+  Vertex get_position() const { return position_; }
+  Direction get_normal() const { return normal_; }
+  const Material& get_material() const { return *material_; }
 };
 
 #endif //INTERSECTION_POINT_H
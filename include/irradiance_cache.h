@@ -0,0 +1,57 @@
+#ifndef IRRADIANCE_CACHE_H
+#define IRRADIANCE_CACHE_H
+
+#include "commons.h"
+#include <vector>
+
+/**
+  Indirect irradiance at a diffuse point, i.e. the mean radiance arriving
+  over the cosine weighted hemisphere (the same quantity Raytracer::Shade
+  estimates with one bounce ray).
+
+  The gradients (one vector per color channel) follow Ward & Heckbert,
+  "Irradiance Gradients" (1992).
+*/
+struct IrradianceRecord {
+  Vertex position;
+  Direction normal;
+  ColorDbl irradiance;
+  float radius; // harmonic mean distance to the surrounding geometry
+  Direction rotational_gradient[3];
+  Direction translational_gradient[3];
+};
+
+/**
+  Sparse irradiance records in an octree. Records are added between render
+  passes only, so any number of threads can look up at the same time.
+*/
+class IrradianceCache {
+private:
+  struct Node {
+    Vertex center;
+    float half_size;
+    int children[8];
+    std::vector<int> records;
+  };
+
+  std::vector<IrradianceRecord> records_;
+  std::vector<Node> nodes_;
+  float error_threshold_;
+
+  int AddNode(Vertex center, float half_size);
+  void Insert(int node, int record, float record_half_size, int depth);
+
+public:
+  // All records and lookups have to be inside [min, max]
+  IrradianceCache(Vertex min, Vertex max, float error_threshold);
+
+  void Add(const IrradianceRecord& record);
+  // Interpolates the records that are valid at position, false if there are
+  // none
+  bool Lookup(Vertex position, Direction normal, ColorDbl& irradiance) const;
+
+  size_t get_size() const { return records_.size(); }
+  float get_error_threshold() const { return error_threshold_; }
+};
+
+#endif // IRRADIANCE_CACHE_H
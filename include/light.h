@@ -10,6 +10,7 @@ protected:
   ColorDbl color_;
 public:
   virtual ~Light() = default;
+  virtual Light* Clone(Arena& arena, const MeshCopies& meshes) const = 0;
   float get_intensity() { return intensity_; }
   ColorDbl get_color() { return color_; }
 };
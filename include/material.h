@@ -2,9 +2,21 @@
 #define MATERIAL_H
 
 #include "commons.h"
+#include <stdint.h>
+
+// Which shading kernel a material uses. Only the first non-zero of
+// specular and transparence counts, in that order, so e.g. GLASS_MAT
+// currently shades as a mirror
+enum MaterialType : uint8_t {
+  MATERIAL_LAMBERTIAN,
+  MATERIAL_MIRROR,
+  MATERIAL_GLASS,
+};
+const int MATERIAL_TYPE_COUNT = 3;
 
 class Material {
 private:
+  MaterialType type_;
   float diffuse_;
   float specular_;
   float transparence_;
@@ -15,11 +27,12 @@ public:
   Material() = default;
   Material(float diffuse, float specular, float transparence, ColorDbl color, glm::vec3 emission);
 
-  float get_diffuse() { return diffuse_; }
-  glm::vec3 get_emission() { return emission_; }
-  float get_specular() { return specular_; }
-  float get_transparence() { return transparence_; }
-  ColorDbl get_color() { return color_; }
+  MaterialType get_type() const { return type_; }
+  float get_diffuse() const { return diffuse_; }
+  glm::vec3 get_emission() const { return emission_; }
+  float get_specular() const { return specular_; }
+  float get_transparence() const { return transparence_; }
+  ColorDbl get_color() const { return color_; }
 };
 
 #endif // MATERIAL_H
@@ -0,0 +1,37 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "triangle.h"
+#include "compressed_bvh.h"
+#include <vector>
+
+/**
+  Triangles with their own BVH in object space. A mesh is not a scene object
+  by itself, it is placed in the scene by one or more Instances, which all
+  share the triangles.
+*/
+class Mesh {
+protected:
+  std::vector<Triangle> triangles_;
+  CompressedBvh bvh_;
+
+public:
+  Mesh() = default;
+  explicit Mesh(std::vector<Triangle> triangles);
+  virtual ~Mesh() = default;
+  virtual Mesh* Clone(Arena& arena) const { return arena.Create<Mesh>(*this); }
+
+  // Has to be called again whenever triangles_ changes
+  void BuildBvh();
+
+  Aabb get_bounds() const { return bvh_.get_bounds(); }
+  size_t get_size() const { return triangles_.size(); }
+  const Triangle& get_triangle(int i) const { return triangles_[i]; }
+  bool HasCausticMaterial() const;
+
+  // Index of the closest triangle hit closer than t (which is then updated),
+  // -1 if there is none. direction does not need to be normalized
+  int Intersect(Vertex origin, Direction direction, float& t) const;
+};
+
+#endif // MESH_H
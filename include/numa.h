@@ -0,0 +1,28 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <string>
+#include <vector>
+
+/**
+  CPUs of every NUMA node, as listed in /sys/devices/system/node and
+  restricted to the CPUs this process may run on. Where that information is
+  missing everything is one node.
+*/
+class NumaTopology {
+private:
+  std::vector<std::vector<int>> node_cpus_;
+
+public:
+  static NumaTopology Detect();
+
+  int get_node_count() const { return node_cpus_.size(); }
+  const std::vector<int>& get_cpus(int node) const { return node_cpus_[node]; }
+
+  // Pins the calling thread to one CPU, false if that is not possible here
+  static bool PinThread(int cpu);
+  // Parses the kernel's CPU list format, e.g. "0-3,8-11"
+  static std::vector<int> ParseCpuList(const std::string& list);
+};
+
+#endif // NUMA_H
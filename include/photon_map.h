@@ -0,0 +1,46 @@
+#ifndef PHOTON_MAP_H
+#define PHOTON_MAP_H
+
+#include "commons.h"
+#include <memory>
+#include <vector>
+
+class Scene;
+
+struct Photon {
+  Vertex position;
+  ColorDbl power;
+  Direction direction; // direction the photon travelled in
+  unsigned char axis; // split axis of the kd-tree node
+};
+
+/**
+  Caustic photons (light -> mirror/glass -> diffuse surface) in a balanced
+  kd-tree that is stored flat: the photon splitting [begin, end) is at
+  (begin + end) / 2, so no child pointers are needed and a lookup walks one
+  contiguous array.
+*/
+class PhotonMap {
+private:
+  std::vector<Photon> photons_;
+
+  void Balance(int begin, int end);
+  void Locate(int begin, int end, Vertex position, int k, std::pair<float, int>* heap,
+              int& heap_size, float& max_distance2) const;
+
+public:
+  explicit PhotonMap(std::vector<Photon> photons);
+
+  // Emits photon_count photons (in parallel) from the lights of the scene,
+  // aimed at the objects that can focus light
+  static std::unique_ptr<PhotonMap> BuildCausticMap(Scene& scene, int photon_count,
+                                                    unsigned int seed);
+
+  // Irradiance at a surface point from the k nearest photons within
+  // max_radius that arrive at the front side of the surface
+  ColorDbl EstimateIrradiance(Vertex position, Direction normal, int k, float max_radius) const;
+
+  size_t get_size() const { return photons_.size(); }
+};
+
+#endif // PHOTON_MAP_H
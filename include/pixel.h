@@ -2,23 +2,39 @@
 #define PIXEL_H
 
 #include <glm/glm.hpp>
+#include <vector>
 
 class Ray;
 
 class Pixel {
 private:
+  // Sum of all samples added so far, or the clear color while the pixel is empty
   glm::vec3 color_;
+  unsigned int samples_;
 
   //TODO: extend this to allow more than one ray
   Ray* ray_;
 
 public:
-  Pixel() {}
+  Pixel() : color_(0.f, 0.f, 0.f), samples_(0), ray_(nullptr) {}
 
-  glm::vec3 get_color() { return color_; }
+  glm::vec3 get_color() { return samples_ > 0 ? color_ / (float)samples_ : color_; }
+  glm::vec3 get_accumulated_color() { return samples_ > 0 ? color_ : glm::vec3(0.f, 0.f, 0.f); }
+  unsigned int get_samples() { return samples_; }
   Ray* get_ray_pointer() { return ray_; }
 
-  void set_color(glm::vec3 color) { color_ = color; }
+  // Clears the accumulated samples
+  void set_color(glm::vec3 color) { color_ = color; samples_ = 0; }
+
+  void AddSamples(glm::vec3 color_sum, unsigned int samples) {
+    if (samples == 0) {
+      return;
+    }
+    color_ = samples_ > 0 ? color_ + color_sum : color_sum;
+    samples_ += samples;
+  }
 };
 
+typedef std::vector<std::vector<Pixel>> Framebuffer;
+
 #endif // PIXEL_H
@@ -14,9 +14,13 @@ public:
   PointLight(Vertex position, float intensity);
   PointLight(Vertex position, float intensity, ColorDbl color);
 
-  virtual std::unique_ptr<IntersectionPoint> RayIntersection(Ray& ray) {
+  virtual IntersectionPoint* RayIntersection(Ray& ray, Arena& /*arena*/) {
     return nullptr; // a ray cannot hit a point of zero area
   }
+  virtual Aabb GetBounds() { return Aabb(position_, position_); }
+  virtual PointLight* Clone(Arena& arena, const MeshCopies& /*meshes*/) const {
+    return arena.Create<PointLight>(*this);
+  }
 };
 
 #endif //POINT_LIGHT_H
@@ -12,6 +12,10 @@ private:
 
 public:
   bool has_hit_diffuse = false;
+  // How far the origin was moved off the surface the ray leaves and the
+  // normal of that surface, 0 for camera rays
+  float origin_offset = 0.f;
+  Direction origin_normal = Direction(0.f, 0.f, 0.f);
   Ray(Vertex origin, Direction direction) : origin_(origin),
       direction_(glm::normalize(direction)), importance_(1.0f) {}
   Ray(Vertex origin, Direction direction, float importance) : origin_(origin),
@@ -24,6 +28,11 @@ public:
   Direction get_direction() { return direction_; }
 
   void set_refraction_status(bool status) { is_inside_object = status; }
+
+  // Moves a point on a surface to the side direction leaves through, far
+  // enough that the rounding error of the point cannot put it behind the
+  // surface
+  static Vertex OffsetOrigin(Vertex position, Direction normal, Direction direction);
 };
 
 #endif // RAY_H
@@ -8,21 +8,114 @@
 #include "ray.h"
 #include "commons.h"
 #include <memory>
+#include <random>
 #include "intersection_point.h"
+#include "arena.h"
+#include "material.h"
 
 class Scene;
+class IrradianceCache;
+struct IrradianceRecord;
+class PhotonMap;
+struct Photon;
+
+// One vertex of a camera or light subpath of the bidirectional integrator
+struct PathVertex {
+  Vertex position;
+  Direction normal; // normalized, unused for the camera and point lights
+  Direction incoming; // normalized, towards the previous vertex
+  const Material* material; // nullptr for the camera and point lights
+  ColorDbl beta; // contribution of the subpath up to here over its pdf
+  float pdf_fwd; // area density of sampling this vertex from the previous one
+  float pdf_rev; // same from the next one, as if the path was traced the other way
+  bool delta; // mirror or glass, which no other vertex can connect to
+};
 
 class Raytracer {
 private:
+  std::default_random_engine generator_;
+  std::uniform_real_distribution<float> distribution_;
+
+  // Intersection points of the current sample, released by Seed()
+  Arena scratch_;
+
+  const IrradianceCache* irradiance_cache_;
+  const PhotonMap* caustic_map_;
+
+  // Set while FindFirstDiffuseHit() is tracing
+  bool find_diffuse_hit_;
+  bool found_diffuse_hit_;
+  Vertex diffuse_hit_position_;
+  Direction diffuse_hit_normal_;
+
+  // Rays lost to hitting the surface they start on, or to missing the
+  // (closed) scene altogether
+  long long self_hits_;
+  long long leaks_;
+  // Closest hit and shadow rays traced so far
+  long long rays_;
+
   ColorDbl HandleRefraction(Ray& ray, IntersectionPoint& p, Scene& scene, unsigned int& depth);
+  bool GetRefractedRay(Ray& ray, IntersectionPoint& p, Ray& refraction_ray);
+  // One specialization per MaterialType, so the hot path does not need to
+  // look at the material coefficients to find out what to do
+  template <MaterialType type>
+  ColorDbl ShadeKernel(Ray& ray, IntersectionPoint& p, Scene& scene, unsigned int& depth);
+  template <MaterialType type>
+  void ShadeRange(Ray* rays, IntersectionPoint** hits, const int* order, int count,
+                  Scene& scene, unsigned int& depth, ColorDbl* colors);
   ColorDbl Shade(Ray& ray, IntersectionPoint& p, Scene& scene, unsigned int& depth);
+  // Shades many hits grouped by material, one kernel at a time. Hits may be
+  // nullptr for rays that escaped
+  void ShadeBatch(Ray* rays, IntersectionPoint** hits, int count, Scene& scene,
+                  unsigned int& depth, ColorDbl* colors);
   ColorDbl CalculateDirectIllumination(Ray& ray, IntersectionPoint& p, Scene& scene);
-  std::unique_ptr<IntersectionPoint> GetClosestIntersectionPoint(Ray& ray, Scene& scene);
+  IntersectionPoint* GetClosestIntersectionPoint(Ray& ray, Scene& scene);
   bool CastShadowRay(Ray& ray, Scene& scene, Direction& light_direction);
+
+  // Extends a subpath whose first vertex the caller set, beta and pdf_dir
+  // belong to ray. Returns the number of vertices
+  int RandomWalk(Ray ray, ColorDbl beta, float pdf_dir, PathVertex* path, int max_vertices, Scene& scene);
+  // Unweighted contribution of connecting the first t camera and s light
+  // vertices, including the shadow ray
+  ColorDbl Connect(PathVertex* camera_path, int t, PathVertex* light_path, int s, Scene& scene);
+  float BidirectionalMisWeight(PathVertex* camera_path, int t, PathVertex* light_path, int s);
  
 public:
   Raytracer();
   ColorDbl Raytrace(Ray& ray, Scene& scene, unsigned int depth);
+  // Physically based alternative to Raytrace(): traces a subpath from the
+  // camera and one from a light, connects every pair of their vertices and
+  // weights the connections with multiple importance sampling, so light
+  // that only reaches the visible surfaces via mirrors, glass or several
+  // diffuse bounces is found from whichever end is easier
+  ColorDbl TraceBidirectional(Ray& ray, Scene& scene);
+
+  // Every sample is traced with its own seed so renders are reproducible
+  // no matter how they are split up between threads, passes or processes
+  void Seed(unsigned int seed);
+  float Random() { return distribution_(generator_); }
+
+  // Interpolates the indirect light at first diffuse hits from the cache
+  // (when there is a valid record) instead of tracing a bounce ray
+  void set_irradiance_cache(const IrradianceCache* cache) { irradiance_cache_ = cache; }
+  // Closest hit of the ray, and whether it is on a diffuse surface, i.e.
+  // one that looks the same from every direction
+  bool FindFirstHit(Ray& ray, Scene& scene, Vertex& position, bool& diffuse);
+  // Follows the ray through mirrors and glass to the first diffuse surface
+  bool FindFirstDiffuseHit(Ray& ray, Scene& scene, Vertex& position, Direction& normal);
+  // Samples the hemisphere above a diffuse point with a stratified set of
+  // bounce rays and estimates the irradiance gradients from them
+  IrradianceRecord ComputeIrradianceRecord(Vertex position, Direction normal, Scene& scene);
+
+  // Adds caustics from the photon map to the direct light of diffuse hits
+  void set_caustic_map(const PhotonMap* caustic_map) { caustic_map_ = caustic_map; }
+  long long get_self_hits() const { return self_hits_; }
+  long long get_leaks() const { return leaks_; }
+  long long get_rays() const { return rays_; }
+  // Follows a photon through mirrors and glass, returns true and the photon
+  // to store if it reaches a diffuse surface after at least one of them
+  bool TraceCausticPhoton(Ray& ray, ColorDbl power, Scene& scene, Photon& photon);
 };
 
 #endif // Raytracer_H
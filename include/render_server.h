@@ -0,0 +1,71 @@
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include <string>
+#include "commons.h"
+#include "camera.h"
+#include "scene.h"
+
+/**
+  One render request, sent as a single line of "key=value" words after the
+  word "render", e.g.
+
+    render spp=16 width=320 height=240 eye=-1,0,0.2 time=0.5 output=preview
+
+  The image plane is fixed, so the camera is given by its eye position.
+  Images are written like the ones of a normal run, with output as the name
+  (results/si_<output>_<width>x<height>_gamma*.ppm and hdr_<output>_*.pfm/exr)
+*/
+struct RenderJob {
+  int spp = 1;
+  int width = WIDTH;
+  int height = HEIGHT;
+  Vertex eye = Vertex(-1, 0, 0);
+  float time = 0.f;
+  unsigned int seed = 0;
+  bool irradiance_cache = false;
+  int caustic_photons = 0;
+  std::string output = "job";
+
+  // Reads the words after "render", false with a message if one is invalid
+  static bool Parse(const std::string& words, RenderJob& job, std::string& error);
+};
+
+/**
+  Long-lived render process listening on a Unix domain socket. The scene and
+  its acceleration structures are built once and the render threads stay
+  alive between jobs, so small renders cost little more than their rays.
+
+  The protocol is line based. A client sends one command per line:
+    render KEY=VALUE...   see RenderJob
+    status                replies "ok <jobs rendered> <scene time>"
+    shutdown              replies "ok", then the server exits
+  and while a job renders the server replies with
+    progress <percent>
+  lines, followed by "done <seconds> <ppm path> <pfm path>" or
+  "error <message>". Clients are served one at a time in the order they
+  connect, which is also the job queue.
+*/
+class RenderServer {
+private:
+  std::string socket_path_;
+  Scene scene_;
+  int jobs_rendered_;
+
+  // Serves one client, false if it asked the server to shut down
+  bool HandleClient(int fd);
+  void RunJob(int fd, const RenderJob& job);
+
+public:
+  explicit RenderServer(std::string socket_path);
+
+  // Listens until a client sends "shutdown", false if the socket could not
+  // be set up
+  bool Run();
+
+  // Client side: sends one command and prints the replies until the final
+  // one, false if the server could not be reached or replied with an error
+  static bool Submit(const std::string& socket_path, const std::string& command);
+};
+
+#endif // RENDER_SERVER_H
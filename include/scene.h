@@ -3,25 +3,82 @@
 
 #include "scene_object.h"
 #include "light.h"
+#include "mesh.h"
+#include "bvh.h"
+#include "grid.h"
+#include "animation.h"
 #include <memory>
 #include <vector>
 
+// What finds the objects a ray hits
+enum SceneAccelerator {
+  ACCELERATOR_AUTO, // picked from the object bounds when the scene is built
+  ACCELERATOR_BVH,
+  ACCELERATOR_GRID,
+};
+
 class Scene {
 private:
-  std::vector<std::unique_ptr<SceneObject>> scene_objects_;
-  std::vector<std::unique_ptr<Light>> scene_lights_;
+  // Owns all objects, lights and meshes below, so they sit next to each
+  // other in a few large blocks instead of one allocation each
+  Arena arena_;
+  std::vector<SceneObject*> scene_objects_;
+  std::vector<Light*> scene_lights_;
+  std::vector<Mesh*> meshes_; // shared by the instances
+  SceneAccelerator accelerator_; // as requested
+  bool use_grid_;
+  Bvh bvh_; // top level, over scene_objects_
+  float bvh_build_cost_; // SAH cost right after the last full build
+  Grid grid_; // used instead of bvh_ if use_grid_
+  float time_ = 0.f;
+  int version_; // changes whenever objects move, unique over all scenes
+
+  struct AnimatedObject {
+    SceneObject* object;
+    Animation animation;
+  };
+  std::vector<AnimatedObject> animated_objects_;
 
   void InitRoom();
   void InitObjects();
   void InitLights();
+  std::vector<Aabb> GetObjectBounds();
+  void BuildAccelerator();
+  // Empty, for Clone()
+  Scene(SceneAccelerator accelerator, bool use_grid);
 public:
-  Scene();
+  explicit Scene(SceneAccelerator accelerator = ACCELERATOR_AUTO);
+  // Deep copy in its own memory, e.g. for the NUMA nodes. The acceleration
+  // structures are copied rather than rebuilt
+  std::unique_ptr<Scene> Clone() const;
+
+  SceneAccelerator get_accelerator() const { return accelerator_; }
+  bool UsesGrid() const { return use_grid_; }
+  // Many objects of about the same size that fill a grid evenly, where a
+  // grid builds much faster than a BVH and traces faster
+  static bool PreferGrid(const std::vector<Aabb>& object_bounds);
+
+  bool IsAnimated() const { return !animated_objects_.empty(); }
+  // Moves the animated objects to where they are at time and refits the
+  // BVH, or rebuilds it if refitting made it too slow. A grid is always
+  // rebuilt. Returns true if the BVH or grid was rebuilt
+  bool SetTime(float time);
+  float get_time() const { return time_; }
+  // A copy of a scene with the same version is up to date
+  int get_version() const { return version_; }
+
+  // Closest hit of the ray, nullptr if it escapes. Hits are allocated from
+  // scratch, which belongs to the calling thread
+  IntersectionPoint* ClosestIntersection(Ray& ray, Arena& scratch);
+  // True if an opaque object is hit closer than max_distance, or any object
+  // if glass should cast shadows too
+  bool Occluded(Ray& ray, float max_distance, Arena& scratch, bool glass_casts_shadows = false);
 
-  const std::vector<std::unique_ptr<SceneObject>>& get_objects() const {
+  const std::vector<SceneObject*>& get_objects() const {
     return scene_objects_;
   }
 
-  const std::vector<std::unique_ptr<Light>>& get_lights() const {
+  const std::vector<Light*>& get_lights() const {
     return scene_lights_;
   }
 };
@@ -3,18 +3,36 @@
 
 #include "commons.h"
 #include "intersection_point.h"
-#include <memory>
+#include "aabb.h"
+#include "arena.h"
+#include <unordered_map>
 
 class Ray;
 class IntersectionPoint;
+class Mesh;
+
+// Copies of the meshes of a scene by original, for Scene::Clone()
+typedef std::unordered_map<const Mesh*, const Mesh*> MeshCopies;
 
 class SceneObject {
 public:
   virtual ~SceneObject() = default;
-  virtual std::unique_ptr<IntersectionPoint> RayIntersection(Ray& ray) = 0;
+  // The closest hit, allocated from arena, or nullptr if the ray misses
+  virtual IntersectionPoint* RayIntersection(Ray& ray, Arena& arena) = 0;
+  virtual Aabb GetBounds() = 0;
+  // Copy allocated from arena, which refers to the copies of its meshes
+  virtual SceneObject* Clone(Arena& arena, const MeshCopies& meshes) const = 0;
 
   Vertex get_position() { return position_; }
 
+  // Bounding sphere of objects with a mirror or glass material, which is
+  // where photons are aimed at to create caustics
+  virtual bool GetCausticBounds(Vertex& /*center*/, float& /*radius*/) { return false; }
+
+  // Moves an animated object, transform is relative to where it was created.
+  // Objects that cannot move ignore it
+  virtual void set_transform(const glm::mat4& /*transform*/) {}
+
 protected:
   SceneObject(Vertex position) { position_ = position; }
   SceneObject() = default;
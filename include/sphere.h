@@ -10,20 +10,25 @@ class Sphere : public SceneObject {
 private:
   float radius_;
   Material material_;
+  Vertex rest_position_;
+  float rest_radius_;
 
 public:
   Sphere(Vertex position, float radius, ColorDbl color);
   Sphere(Vertex position, float radius, Material material);
 
   float get_radius() { return radius_; }
+  const Material& get_material() const { return material_; }
 
-  virtual std::unique_ptr<IntersectionPoint> RayIntersection(Ray& ray);
+  virtual IntersectionPoint* RayIntersection(Ray& ray, Arena& arena);
+  virtual Aabb GetBounds();
+  virtual Sphere* Clone(Arena& arena, const MeshCopies& meshes) const;
+  virtual void set_transform(const glm::mat4& transform);
+  virtual bool GetCausticBounds(Vertex& center, float& radius);
 
-  static bool SolveQuadratic(const float& a,
-                             const float& b,
-                             const float& c,
-                             float& x0,
-                             float& x1);
+  // Updates t and returns true if the ray hits closer than t, direction has
+  // to be normalized
+  static bool Intersect(Vertex origin, Direction direction, Vertex center, float radius, float& t);
 };
 
 #endif // SPHERE_H
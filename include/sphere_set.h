@@ -0,0 +1,66 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include "scene_object.h"
+#include "material.h"
+#include "compressed_bvh.h"
+#include <vector>
+
+// 8 spheres in structure of arrays layout, one AVX register per field.
+// Unused lanes are NaN, which never hits
+struct SphereCluster {
+  float center_x[8];
+  float center_y[8];
+  float center_z[8];
+  float radius[8];
+  int sphere[8]; // index the sphere was added with
+};
+
+/**
+  Many spheres as one scene object, e.g. particles. Spheres that are close
+  to each other are packed into clusters of 8 under a compressed BVH, and a
+  ray is tested against a whole cluster at once: with AVX2 if the CPU has
+  it, otherwise with a scalar loop that gives the same results.
+*/
+class SphereSet : public SceneObject {
+private:
+  std::vector<Vertex> centers_;
+  std::vector<float> radii_;
+  std::vector<int> sphere_materials_;
+  std::vector<Material> materials_;
+  std::vector<SphereCluster> clusters_;
+  CompressedBvh bvh_;
+  bool use_avx2_;
+
+  // Lane of the closest sphere hit closer than t (which is then updated),
+  // -1 if there is none
+  static int IntersectCluster(const SphereCluster& cluster, Vertex origin, Direction direction, float& t);
+  static int IntersectClusterAvx2(const SphereCluster& cluster, Vertex origin, Direction direction, float& t);
+
+public:
+  SphereSet();
+
+  // Spheres refer to their material by the index returned here
+  int AddMaterial(const Material& material);
+  void AddSphere(Vertex center, float radius, int material);
+  // Has to be called after adding spheres and before tracing
+  void Build();
+
+  size_t get_size() const { return centers_.size(); }
+  size_t get_cluster_count() const { return clusters_.size(); }
+  // Uses the scalar kernel even if the CPU has AVX2, for comparisons
+  void EnableAvx2(bool enable) { use_avx2_ = enable && HasAvx2(); }
+  bool IsAvx2Enabled() const { return use_avx2_; }
+  static bool HasAvx2();
+
+  // Index of the closest sphere hit closer than t (which is then updated),
+  // -1 if there is none. direction has to be normalized
+  int Intersect(Vertex origin, Direction direction, float& t) const;
+
+  virtual IntersectionPoint* RayIntersection(Ray& ray, Arena& arena);
+  virtual Aabb GetBounds();
+  virtual SphereSet* Clone(Arena& arena, const MeshCopies& meshes) const;
+  virtual bool GetCausticBounds(Vertex& center, float& radius);
+};
+
+#endif // SPHERE_SET_H
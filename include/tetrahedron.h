@@ -1,15 +1,13 @@
 #ifndef TETRAHEDRON_H
 #define TETRAHEDRON_H
 
-#include "triangle.h"
-#include <vector>
+#include "mesh.h"
 
-class Tetrahedron {
-private:
-  std::vector<Triangle> triangles_;
+class Tetrahedron : public Mesh {
 public:
   Tetrahedron(Triangle& t0, Triangle& t1, Triangle& t2, Triangle& t4);
   Tetrahedron(float width, float height, Vertex position, Material material);
+  virtual Tetrahedron* Clone(Arena& arena) const { return arena.Create<Tetrahedron>(*this); }
 };
 
 #endif // TETRAHEDRON_H
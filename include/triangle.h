@@ -6,6 +6,15 @@
 #include "material.h"
 #include "scene_object.h"
 
+// Per ray constants of Triangle::Intersect(), worth computing once when a
+// ray is tested against many triangles
+struct RayShear {
+  int kx, ky, kz;
+  float sx, sy, sz;
+
+  explicit RayShear(Direction direction);
+};
+
 class Triangle : public SceneObject {
 private:
   Vertex v0_, v1_, v2_;
@@ -20,10 +29,17 @@ public:
   Triangle(Vertex v0, Vertex v1, Vertex v2, ColorDbl color);
   Triangle(Vertex v0, Vertex v1, Vertex v2, Material material);
 
-  Direction get_normal() { return normal_; }
-  Material get_material() { return material_; }
-
-  std::unique_ptr<IntersectionPoint> RayIntersection(Ray& ray);
+  Direction get_normal() const { return normal_; }
+  const Material& get_material() const { return material_; }
+
+  // Updates t and returns true if the ray hits closer than t. Does not
+  // allocate, unlike RayIntersection()
+  bool Intersect(Vertex origin, Direction direction, float& t) const;
+  bool Intersect(Vertex origin, const RayShear& shear, float& t) const;
+  IntersectionPoint* RayIntersection(Ray& ray, Arena& arena);
+  Aabb GetBounds();
+  Triangle* Clone(Arena& arena, const MeshCopies& meshes) const;
+  bool GetCausticBounds(Vertex& center, float& radius);
 
   void Print() const;
 };
@@ -0,0 +1,37 @@
+#include "animation.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+
+void Animation::AddKeyframe(float time, Direction translation, float rotation, float scale) {
+  Keyframe keyframe;
+  keyframe.time = time;
+  keyframe.translation = translation;
+  keyframe.rotation = rotation;
+  keyframe.scale = scale;
+  auto position = std::upper_bound(keyframes_.begin(), keyframes_.end(), time,
+                                   [](float t, const Keyframe& k) { return t < k.time; });
+  keyframes_.insert(position, keyframe);
+}
+
+glm::mat4 Animation::Evaluate(float time) const {
+  if (keyframes_.empty()) {
+    return glm::mat4(1.f);
+  }
+  Keyframe pose = keyframes_.front();
+  if (time >= keyframes_.back().time) {
+    pose = keyframes_.back();
+  } else if (time > keyframes_.front().time) {
+    auto next = std::upper_bound(keyframes_.begin(), keyframes_.end(), time,
+                                 [](float t, const Keyframe& k) { return t < k.time; });
+    const Keyframe& a = *(next - 1);
+    const Keyframe& b = *next;
+    float s = (time - a.time) / (b.time - a.time);
+    pose.translation = (1.f - s) * a.translation + s * b.translation;
+    pose.rotation = (1.f - s) * a.rotation + s * b.rotation;
+    pose.scale = (1.f - s) * a.scale + s * b.scale;
+  }
+  glm::mat4 transform = glm::translate(glm::mat4(1.f), pivot_ + pose.translation);
+  transform = glm::rotate(transform, pose.rotation, Direction(0.f, 0.f, 1.f));
+  transform = glm::scale(transform, Direction(pose.scale, pose.scale, pose.scale));
+  return glm::translate(transform, -pivot_);
+}
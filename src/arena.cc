@@ -0,0 +1,52 @@
+#include "arena.h"
+#include <algorithm>
+#include <stdint.h>
+
+Arena::Arena(size_t block_size) : block_size_(block_size), block_index_(0), offset_(0) {}
+
+Arena::~Arena() {
+  RunDestructors();
+}
+
+void Arena::RunDestructors() {
+  for (auto it = destructors_.rbegin(); it != destructors_.rend(); ++it) {
+    it->destroy(it->object);
+  }
+  destructors_.clear();
+}
+
+void* Arena::Allocate(size_t size, size_t alignment) {
+  while (block_index_ < blocks_.size()) {
+    Block& block = blocks_[block_index_];
+    uintptr_t start = (uintptr_t)block.data.get();
+    size_t aligned = ((start + offset_ + alignment - 1) & ~(uintptr_t)(alignment - 1)) - start;
+    if (aligned + size <= block.size) {
+      offset_ = aligned + size;
+      return block.data.get() + aligned;
+    }
+    block_index_++;
+    offset_ = 0;
+  }
+  // Oversized requests get a block of their own
+  Block block;
+  block.size = std::max(block_size_, size + alignment);
+  block.data.reset(new char[block.size]);
+  blocks_.push_back(std::move(block));
+  block_index_ = blocks_.size() - 1;
+  offset_ = 0;
+  return Allocate(size, alignment);
+}
+
+void Arena::Reset() {
+  RunDestructors();
+  block_index_ = 0;
+  offset_ = 0;
+}
+
+size_t Arena::get_capacity() const {
+  size_t capacity = 0;
+  for (const Block& block : blocks_) {
+    capacity += block.size;
+  }
+  return capacity;
+}
@@ -0,0 +1,384 @@
+#define _USE_MATH_DEFINES // Needed to run in windows/visual studio
+#include "benchmark.h"
+#include "triangle.h"
+#include "bvh.h"
+#include "grid.h"
+#include "compressed_bvh.h"
+#include "sphere.h"
+#include "sphere_set.h"
+#include "ray.h"
+#include "arena.h"
+#include "camera.h"
+#include "scene.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Bumpy terrain on [0, 10] x [0, 10] made of two triangles per grid cell
+static std::vector<Triangle> CreateHeightField(int triangle_count, std::mt19937& generator) {
+  int cells = std::max(1, (int)sqrtf(triangle_count / 2.f));
+  std::uniform_real_distribution<float> jitter(-0.05f, 0.05f);
+  std::vector<Vertex> vertices;
+  for (int j = 0; j <= cells; j++) {
+    for (int i = 0; i <= cells; i++) {
+      float x = 10.f * i / cells;
+      float y = 10.f * j / cells;
+      float z = 0.5f * sinf(1.3f * x) * cosf(0.9f * y) + 0.2f * sinf(4.1f * x + 2.7f * y) + jitter(generator);
+      vertices.push_back(Vertex(x, y, z));
+    }
+  }
+  Material material = Material(1,0,0, COLOR_WHITE, glm::vec3(0,0,0));
+  std::vector<Triangle> triangles;
+  triangles.reserve(2 * cells * cells);
+  for (int j = 0; j < cells; j++) {
+    for (int i = 0; i < cells; i++) {
+      int v = j * (cells + 1) + i;
+      triangles.push_back(Triangle(vertices[v], vertices[v + 1], vertices[v + cells + 2], material));
+      triangles.push_back(Triangle(vertices[v], vertices[v + cells + 2], vertices[v + cells + 1], material));
+    }
+  }
+  return triangles;
+}
+
+template <typename Tree>
+static double TraceRays(const Tree& tree, const std::vector<Triangle>& triangles,
+                        const std::vector<Vertex>& origins, const std::vector<Direction>& directions,
+                        std::vector<int>& hits) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t r = 0; r < origins.size(); r++) {
+    float t = FLT_MAX;
+    int closest = -1;
+    RayShear shear(directions[r]);
+    tree.Traverse(origins[r], directions[r], t, [&](int primitive, float& t_max) {
+      if (triangles[primitive].Intersect(origins[r], shear, t_max)) {
+        closest = primitive;
+      }
+      return false;
+    });
+    hits[r] = closest;
+  }
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Benchmark::Run() {
+  RunBvh(500000, 500000);
+  RunSpheres(100000, 500000);
+  RunGrid(100000, 500000);
+  RunIntegrators(32, 1024, 5.);
+}
+
+void Benchmark::RunBvh(int triangle_count, int ray_count) {
+  std::mt19937 generator(1);
+  std::vector<Triangle> triangles = CreateHeightField(triangle_count, generator);
+  std::vector<Aabb> bounds;
+  for (Triangle& triangle : triangles) {
+    bounds.push_back(triangle.GetBounds());
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  Bvh bvh;
+  bvh.Build(bounds);
+  double build_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  start = std::chrono::steady_clock::now();
+  CompressedBvh compressed_bvh;
+  compressed_bvh.Build(bvh);
+  double collapse_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  // Rays from a sphere around the terrain towards random points on it
+  std::uniform_real_distribution<float> uniform(0.f, 1.f);
+  std::vector<Vertex> origins;
+  std::vector<Direction> directions;
+  for (int r = 0; r < ray_count; r++) {
+    float phi = 2.f * (float)M_PI * uniform(generator);
+    float cos_theta = uniform(generator);
+    float sin_theta = sqrtf(1.f - cos_theta * cos_theta);
+    Vertex origin = Vertex(5.f, 5.f, 0.f) + 15.f * Direction(sin_theta * cosf(phi), sin_theta * sinf(phi), cos_theta);
+    Vertex target = Vertex(10.f * uniform(generator), 10.f * uniform(generator), 0.f);
+    origins.push_back(origin);
+    directions.push_back(glm::normalize(target - origin));
+  }
+
+  std::vector<int> binary_hits(ray_count), compressed_hits(ray_count);
+  double binary_time = TraceRays(bvh, triangles, origins, directions, binary_hits);
+  double compressed_time = TraceRays(compressed_bvh, triangles, origins, directions, compressed_hits);
+  int mismatches = 0;
+  for (int r = 0; r < ray_count; r++) {
+    mismatches += binary_hits[r] != compressed_hits[r];
+  }
+
+  std::cout << "\tBVH over " << triangles.size() << " triangles, " << ray_count << " rays\n"
+            << "\t  binary:     " << bvh.get_nodes().size() << " nodes, "
+            << bvh.GetNodeMemory() / 1024 << " KiB, built in " << build_time << " s, "
+            << ray_count / binary_time * 1e-6 << " Mrays/s\n"
+            << "\t  compressed: " << compressed_bvh.get_node_count() << " nodes, "
+            << compressed_bvh.GetNodeMemory() / 1024 << " KiB, collapsed in " << collapse_time << " s, "
+            << ray_count / compressed_time * 1e-6 << " Mrays/s\n"
+            << "\t  primitive indices (both): " << triangles.size() * sizeof(int) / 1024 << " KiB\n"
+            << "\t  rays with different hits: " << mismatches << std::endl;
+}
+
+void Benchmark::RunSpheres(int sphere_count, int ray_count) {
+  std::mt19937 generator(2);
+  std::uniform_real_distribution<float> uniform(0.f, 1.f);
+  Material material = Material(1,0,0, COLOR_WHITE, glm::vec3(0,0,0));
+  Arena arena;
+  std::vector<SceneObject*> spheres;
+  std::vector<Aabb> bounds;
+  SphereSet sphere_set;
+  int set_material = sphere_set.AddMaterial(material);
+  for (int i = 0; i < sphere_count; i++) {
+    Vertex center = 10.f * Vertex(uniform(generator), uniform(generator), uniform(generator));
+    float radius = 0.02f + 0.04f * uniform(generator);
+    spheres.push_back(arena.Create<Sphere>(center, radius, material));
+    bounds.push_back(spheres.back()->GetBounds());
+    sphere_set.AddSphere(center, radius, set_material);
+  }
+  Bvh bvh;
+  bvh.Build(bounds);
+  auto start = std::chrono::steady_clock::now();
+  sphere_set.Build();
+  double build_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  // Rays from a sphere around the particles towards random points in them
+  std::vector<Vertex> origins;
+  std::vector<Direction> directions;
+  for (int r = 0; r < ray_count; r++) {
+    float phi = 2.f * (float)M_PI * uniform(generator);
+    float cos_theta = 2.f * uniform(generator) - 1.f;
+    float sin_theta = sqrtf(1.f - cos_theta * cos_theta);
+    Vertex origin = Vertex(5.f, 5.f, 5.f) + 15.f * Direction(sin_theta * cosf(phi), sin_theta * sinf(phi), cos_theta);
+    Vertex target = 10.f * Vertex(uniform(generator), uniform(generator), uniform(generator));
+    origins.push_back(origin);
+    directions.push_back(glm::normalize(target - origin));
+  }
+
+  // One virtual call and one allocation per sphere, like loose scene objects
+  std::vector<int> object_hits(ray_count);
+  Arena scratch;
+  start = std::chrono::steady_clock::now();
+  for (int r = 0; r < ray_count; r++) {
+    Ray ray = Ray(origins[r], directions[r]);
+    float t = FLT_MAX;
+    int closest = -1;
+    scratch.Reset();
+    bvh.Traverse(origins[r], directions[r], t, [&](int object, float& t_max) {
+      IntersectionPoint* p = spheres[object]->RayIntersection(ray, scratch);
+      if (p && p->get_z() < t_max) {
+        t_max = p->get_z();
+        closest = object;
+      }
+      return false;
+    });
+    object_hits[r] = closest;
+  }
+  double object_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  bool has_avx2 = SphereSet::HasAvx2();
+  double set_times[2] = { 0., 0. };
+  int mismatches[2] = { 0, 0 };
+  for (int kernel = 0; kernel < (has_avx2 ? 2 : 1); kernel++) {
+    sphere_set.EnableAvx2(kernel == 1);
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < ray_count; r++) {
+      // Same normalization as the separate objects see
+      Ray ray = Ray(origins[r], directions[r]);
+      float t = FLT_MAX;
+      int hit = sphere_set.Intersect(ray.get_origin(), ray.get_direction(), t);
+      mismatches[kernel] += hit != object_hits[r];
+    }
+    set_times[kernel] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  std::cout << "\tSpheres: " << sphere_count << " spheres, " << ray_count << " rays\n"
+            << "\t  separate objects:  " << ray_count / object_time * 1e-6 << " Mrays/s\n"
+            << "\t  sphere set:        " << sphere_set.get_cluster_count() << " clusters of 8, built in "
+            << build_time << " s\n"
+            << "\t    scalar kernel:   " << ray_count / set_times[0] * 1e-6 << " Mrays/s, "
+            << mismatches[0] << " rays with different hits\n";
+  if (has_avx2) {
+    std::cout << "\t    AVX2 kernel:     " << ray_count / set_times[1] * 1e-6 << " Mrays/s, "
+              << mismatches[1] << " rays with different hits" << std::endl;
+  } else {
+    std::cout << "\t    AVX2 kernel:     not supported by this CPU" << std::endl;
+  }
+}
+
+static Camera CreateIntegratorCamera(Integrator integrator, int size, unsigned int seed) {
+  Camera cam = Camera(Vertex(-1, 0, 0), Vertex(-1, 0, 0), Direction(1, 0, 0), Direction(0, 0, 1), size, size);
+  cam.ClearColorBuffer(COLOR_BLACK);
+  cam.set_seed(seed);
+  cam.set_integrator(integrator);
+  cam.set_progress_callback([](double) {});
+  return cam;
+}
+
+// RMS error over the mean of the reference, which is the average of two
+// independent halves. The squared error includes the variance of the
+// reference, estimated from the difference of the halves and subtracted
+static double RelativeError(Camera& cam, Camera& reference_a, Camera& reference_b, int size) {
+  double squared_error = 0.;
+  double sum = 0.;
+  for (int x = 0; x < size; x++) {
+    for (int y = 0; y < size; y++) {
+      ColorDbl a = reference_a.get_pixel_color(x, y);
+      ColorDbl b = reference_b.get_pixel_color(x, y);
+      ColorDbl difference = cam.get_pixel_color(x, y) - 0.5f * (a + b);
+      squared_error += glm::dot(difference, difference) - 0.25 * glm::dot(a - b, a - b);
+      sum += a.x + a.y + a.z + b.x + b.y + b.z;
+    }
+  }
+  double values = 3. * size * size;
+  double mean = 0.5 * sum / values;
+  return mean > 0. ? sqrt(std::max(0., squared_error / values)) / mean : 0.;
+}
+
+void Benchmark::RunIntegrators(int size, int reference_spp, double max_seconds) {
+  const Integrator integrators[] = { INTEGRATOR_RAYTRACE, INTEGRATOR_BIDIRECTIONAL };
+  const char* names[] = { "ray tracing:  ", "bidirectional:" };
+  const double errors[] = { 0.2, 0.1, 0.05 };
+  const int error_count = sizeof(errors) / sizeof(double);
+  Scene scene;
+
+  std::cout << "\tIntegrators: " << size << "x" << size << ", seconds to get below a relative RMS error of";
+  for (int e = 0; e < error_count; e++) {
+    std::cout << (e > 0 ? ", " : " ") << 100. * errors[e] << "%";
+  }
+  std::cout << " (references with " << reference_spp << " spp)" << std::endl;
+  for (int k = 0; k < 2; k++) {
+    Camera reference_a = CreateIntegratorCamera(integrators[k], size, 1);
+    reference_a.Render(scene, reference_spp / 2);
+    Camera reference_b = CreateIntegratorCamera(integrators[k], size, 2);
+    reference_b.Render(scene, reference_spp / 2);
+
+    Camera cam = CreateIntegratorCamera(integrators[k], size, 3);
+    double seconds = 0.;
+    double error = 1.;
+    double times[error_count];
+    int reached = 0;
+    while (reached < error_count && seconds < max_seconds) {
+      auto start = std::chrono::steady_clock::now();
+      cam.Render(scene, 1);
+      seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      error = RelativeError(cam, reference_a, reference_b, size);
+      for (; reached < error_count && error < errors[reached]; reached++) {
+        times[reached] = seconds;
+      }
+    }
+    std::cout << "\t  " << names[k];
+    for (int e = 0; e < error_count; e++) {
+      if (e < reached) {
+        std::cout << " " << times[e] << " s";
+      } else {
+        std::cout << " -";
+      }
+    }
+    std::cout << ", " << 100. * error << "% after " << cam.get_samples_rendered() << " spp in "
+              << seconds << " s" << std::endl;
+  }
+}
+
+// Distances to the closest hits of loose scene objects, like
+// Scene::ClosestIntersection(). Distances rather than objects are compared,
+// in dense clumps two spheres can be hit at the same distance
+template <typename Accelerator>
+static double TraceObjects(const Accelerator& accelerator, const std::vector<SceneObject*>& objects,
+                           const std::vector<Vertex>& origins, const std::vector<Direction>& directions,
+                           std::vector<float>& distances) {
+  Arena scratch;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t r = 0; r < origins.size(); r++) {
+    Ray ray = Ray(origins[r], directions[r]);
+    float t = FLT_MAX;
+    scratch.Reset();
+    accelerator.Traverse(origins[r], directions[r], t, [&](int object, float& t_max) {
+      IntersectionPoint* p = objects[object]->RayIntersection(ray, scratch);
+      if (p && p->get_z() < t_max) {
+        t_max = p->get_z();
+      }
+      return false;
+    });
+    distances[r] = t;
+  }
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Benchmark::RunGrid(int sphere_count, int ray_count) {
+  std::cout << "\tGrid vs BVH: " << sphere_count << " spheres as separate objects, " << ray_count << " rays" << std::endl;
+  Material material = Material(1,0,0, COLOR_WHITE, glm::vec3(0,0,0));
+  int wrong_picks = 0;
+  for (int layout = 0; layout < 2; layout++) {
+    bool clustered = layout == 1;
+    std::mt19937 generator(3);
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+    std::normal_distribution<float> normal(0.f, 1.f);
+    // Particles of about the same size spread over [0, 10]^3, or the same
+    // particles in 8 small clumps of different sizes
+    std::vector<Vertex> clump_centers;
+    for (int c = 0; c < 8; c++) {
+      clump_centers.push_back(Vertex(1.f, 1.f, 1.f) + 8.f * Vertex(uniform(generator), uniform(generator), uniform(generator)));
+    }
+    Arena arena;
+    std::vector<SceneObject*> spheres;
+    std::vector<Aabb> bounds;
+    for (int i = 0; i < sphere_count; i++) {
+      Vertex center;
+      if (clustered) {
+        int c = i % clump_centers.size();
+        float spread = 0.03f + 0.03f * c;
+        center = clump_centers[c] + spread * Vertex(normal(generator), normal(generator), normal(generator));
+      } else {
+        center = 10.f * Vertex(uniform(generator), uniform(generator), uniform(generator));
+      }
+      float radius = 0.02f + 0.04f * uniform(generator);
+      spheres.push_back(arena.Create<Sphere>(center, radius, material));
+      bounds.push_back(spheres.back()->GetBounds());
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    Bvh bvh;
+    bvh.Build(bounds);
+    double bvh_build_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    Grid grid;
+    grid.Build(bounds);
+    double grid_build_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Rays from a sphere around the scene towards the particles
+    std::vector<Vertex> origins;
+    std::vector<Direction> directions;
+    for (int r = 0; r < ray_count; r++) {
+      float phi = 2.f * (float)M_PI * uniform(generator);
+      float cos_theta = 2.f * uniform(generator) - 1.f;
+      float sin_theta = sqrtf(1.f - cos_theta * cos_theta);
+      Vertex origin = Vertex(5.f, 5.f, 5.f) + 15.f * Direction(sin_theta * cosf(phi), sin_theta * sinf(phi), cos_theta);
+      Vertex target = bounds[r % sphere_count].Centroid();
+      origins.push_back(origin);
+      directions.push_back(glm::normalize(target - origin));
+    }
+
+    std::vector<float> bvh_hits(ray_count), grid_hits(ray_count);
+    double bvh_time = TraceObjects(bvh, spheres, origins, directions, bvh_hits);
+    double grid_time = TraceObjects(grid, spheres, origins, directions, grid_hits);
+    int mismatches = 0;
+    for (int r = 0; r < ray_count; r++) {
+      mismatches += bvh_hits[r] != grid_hits[r];
+    }
+    // A render traces many more rays than this, so the pick is judged by
+    // tracing speed alone
+    bool prefer_grid = Scene::PreferGrid(bounds);
+    wrong_picks += prefer_grid != (grid_time < bvh_time);
+
+    std::cout << "\t  " << (clustered ? "clustered:" : "uniform:  ") << "\n"
+              << "\t    BVH:  " << bvh.get_nodes().size() << " nodes, built in " << bvh_build_time << " s, "
+              << ray_count / bvh_time * 1e-6 << " Mrays/s\n"
+              << "\t    grid: " << grid.get_cell_count() << " cells, " << grid.GetMemory() / 1024 << " KiB, "
+              << 100.f * grid.GetOccupancy() << "% occupied, built in " << grid_build_time << " s, "
+              << ray_count / grid_time * 1e-6 << " Mrays/s\n"
+              << "\t    picked: " << (prefer_grid ? "grid" : "BVH") << ", rays with different hits: "
+              << mismatches << std::endl;
+  }
+  std::cout << "\t  picks that trace slower than the other structure: " << wrong_picks << std::endl;
+}
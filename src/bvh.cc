@@ -0,0 +1,182 @@
+#include "bvh.h"
+#include <algorithm>
+#include <numeric>
+
+const int BVH_BIN_COUNT = 12;
+const int BVH_MAX_LEAF_SIZE = 8; // CompressedBvh and SphereSet rely on this
+const float BVH_TRAVERSAL_COST = 1.f; // relative to one primitive test
+const size_t BVH_PARALLEL_REFIT_SIZE = 1024; // smaller levels are not worth the threads
+
+void Bvh::Build(const std::vector<Aabb>& primitive_bounds) {
+  nodes_.clear();
+  levels_.clear();
+  indices_.resize(primitive_bounds.size());
+  std::iota(indices_.begin(), indices_.end(), 0);
+  if (primitive_bounds.empty()) {
+    return;
+  }
+  nodes_.reserve(2 * primitive_bounds.size());
+  BvhNode root;
+  root.left_first = 0;
+  root.count = primitive_bounds.size();
+  nodes_.push_back(root);
+  levels_.push_back(std::vector<int>(1, 0));
+  UpdateNodeBounds(0, primitive_bounds);
+  Subdivide(0, 0, primitive_bounds);
+  nodes_.shrink_to_fit();
+}
+
+void Bvh::Refit(const std::vector<Aabb>& primitive_bounds) {
+  for (int depth = (int)levels_.size() - 1; depth >= 0; depth--) {
+    const std::vector<int>& level = levels_[depth];
+    #pragma omp parallel for if (level.size() >= BVH_PARALLEL_REFIT_SIZE)
+    for (int i = 0; i < (int)level.size(); i++) {
+      int node = level[i];
+      if (nodes_[node].count > 0) {
+        UpdateNodeBounds(node, primitive_bounds);
+      } else {
+        Aabb bounds = nodes_[nodes_[node].left_first].bounds;
+        bounds.Extend(nodes_[nodes_[node].left_first + 1].bounds);
+        nodes_[node].bounds = bounds;
+      }
+    }
+  }
+}
+
+float Bvh::ComputeSahCost() const {
+  if (nodes_.empty() || nodes_[0].bounds.SurfaceArea() <= 0.f) {
+    return 0.f;
+  }
+  float cost = 0.f;
+  for (const BvhNode& node : nodes_) {
+    cost += (node.count > 0 ? node.count : BVH_TRAVERSAL_COST) * node.bounds.SurfaceArea();
+  }
+  return cost / nodes_[0].bounds.SurfaceArea();
+}
+
+void Bvh::UpdateNodeBounds(int node, const std::vector<Aabb>& primitive_bounds) {
+  Aabb bounds;
+  for (int i = 0; i < nodes_[node].count; i++) {
+    bounds.Extend(primitive_bounds[indices_[nodes_[node].left_first + i]]);
+  }
+  nodes_[node].bounds = bounds;
+}
+
+// Splits at the best of BVH_BIN_COUNT - 1 planes per axis according to the
+// surface area heuristic, or keeps the node as a leaf if that is cheaper.
+// Close to BVH_MAX_DEPTH it splits at the median instead, which gets to
+// leaves in the fewest levels
+void Bvh::Subdivide(int node, int depth, const std::vector<Aabb>& primitive_bounds) {
+  int first = nodes_[node].left_first;
+  int count = nodes_[node].count;
+  if (count <= 2) {
+    return;
+  }
+  int median_levels = 0;
+  while ((long long)BVH_MAX_LEAF_SIZE << median_levels < count) {
+    median_levels++;
+  }
+  bool median_split = depth + median_levels >= BVH_MAX_DEPTH - 1;
+  if (median_split && count <= BVH_MAX_LEAF_SIZE) {
+    return;
+  }
+  Aabb centroid_bounds;
+  for (int i = first; i < first + count; i++) {
+    centroid_bounds.Extend(primitive_bounds[indices_[i]].Centroid());
+  }
+
+  float best_cost = FLT_MAX;
+  int best_axis = -1;
+  int best_split = 0;
+  for (int axis = 0; axis < 3 && !median_split; axis++) {
+    float min = centroid_bounds.min[axis];
+    float extent = centroid_bounds.max[axis] - min;
+    if (extent <= 0.f) {
+      continue;
+    }
+    Aabb bin_bounds[BVH_BIN_COUNT];
+    int bin_count[BVH_BIN_COUNT] = { 0 };
+    float scale = BVH_BIN_COUNT / extent;
+    for (int i = first; i < first + count; i++) {
+      const Aabb& bounds = primitive_bounds[indices_[i]];
+      int bin = std::min(BVH_BIN_COUNT - 1, (int)((bounds.Centroid()[axis] - min) * scale));
+      bin_bounds[bin].Extend(bounds);
+      bin_count[bin]++;
+    }
+    // Sweep from both sides to get the cost of every split plane
+    float left_area[BVH_BIN_COUNT - 1], right_area[BVH_BIN_COUNT - 1];
+    int left_count[BVH_BIN_COUNT - 1], right_count[BVH_BIN_COUNT - 1];
+    Aabb left_box, right_box;
+    int left_sum = 0, right_sum = 0;
+    for (int i = 0; i < BVH_BIN_COUNT - 1; i++) {
+      left_box.Extend(bin_bounds[i]);
+      left_sum += bin_count[i];
+      left_area[i] = left_box.SurfaceArea();
+      left_count[i] = left_sum;
+      right_box.Extend(bin_bounds[BVH_BIN_COUNT - 1 - i]);
+      right_sum += bin_count[BVH_BIN_COUNT - 1 - i];
+      right_area[BVH_BIN_COUNT - 2 - i] = right_box.SurfaceArea();
+      right_count[BVH_BIN_COUNT - 2 - i] = right_sum;
+    }
+    for (int i = 0; i < BVH_BIN_COUNT - 1; i++) {
+      if (left_count[i] == 0 || right_count[i] == 0) {
+        continue;
+      }
+      float cost = left_count[i] * left_area[i] + right_count[i] * right_area[i];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_split = i;
+      }
+    }
+  }
+  int left_count;
+  if (median_split) {
+    int axis = centroid_bounds.LongestAxis();
+    left_count = count / 2;
+    std::nth_element(indices_.data() + first, indices_.data() + first + left_count, indices_.data() + first + count,
+                     [&](int a, int b) {
+      return primitive_bounds[a].Centroid()[axis] < primitive_bounds[b].Centroid()[axis];
+    });
+  } else if (best_axis < 0) {
+    // All centroids in the same spot, split anyway if the leaf is too large
+    if (count <= BVH_MAX_LEAF_SIZE) {
+      return;
+    }
+    left_count = count / 2;
+  } else {
+    float parent_area = nodes_[node].bounds.SurfaceArea();
+    float split_cost = BVH_TRAVERSAL_COST + (parent_area > 0.f ? best_cost / parent_area : 0.f);
+    if (split_cost >= count && count <= BVH_MAX_LEAF_SIZE) {
+      return;
+    }
+    float min = centroid_bounds.min[best_axis];
+    float scale = BVH_BIN_COUNT / (centroid_bounds.max[best_axis] - min);
+    int* middle = std::partition(indices_.data() + first, indices_.data() + first + count, [&](int primitive) {
+      int bin = std::min(BVH_BIN_COUNT - 1,
+                         (int)((primitive_bounds[primitive].Centroid()[best_axis] - min) * scale));
+      return bin <= best_split;
+    });
+    left_count = middle - (indices_.data() + first);
+  }
+
+  int left = nodes_.size();
+  BvhNode child;
+  child.left_first = first;
+  child.count = left_count;
+  nodes_.push_back(child);
+  child.left_first = first + left_count;
+  child.count = count - left_count;
+  nodes_.push_back(child);
+  nodes_[node].left_first = left;
+  nodes_[node].count = 0;
+  if ((int)levels_.size() == depth + 1) {
+    levels_.emplace_back();
+  }
+  levels_[depth + 1].push_back(left);
+  levels_[depth + 1].push_back(left + 1);
+  UpdateNodeBounds(left, primitive_bounds);
+  UpdateNodeBounds(left + 1, primitive_bounds);
+  Subdivide(left, depth + 1, primitive_bounds);
+  Subdivide(left + 1, depth + 1, primitive_bounds);
+}
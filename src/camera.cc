@@ -3,20 +3,82 @@
 #include "raytracer.h"
 #include "ray.h"
 #include "scene.h"
+#include "hdr_image.h"
+#include "irradiance_cache.h"
+#include "photon_map.h"
+#include "numa.h"
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
 // TODO: Remove when we have all point lights in vector
 #include <iostream>
 #include <sstream>
-#include <random>
+#include <atomic>
+#include <chrono>
+#include <cassert>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 
 // TODO: Place these somewhere that makes the most sense and remove some?
 const float EPSILON = 0.00001f;
 const float GAMMA_FACTOR = 3.6f;
+const int TILE_SIZE = 16;
 
-std::default_random_engine generator;
-std::uniform_real_distribution<float> distribution(0, 1);
+// The irradiance cache is filled coarse to fine: first from the diffuse hits
+// of every 32nd pixel, then every 16th... down to every 4th pixel, only adding
+// records where the coarser levels left gaps
+const int IRRADIANCE_CACHE_STRIDES[] = { 32, 16, 8, 4 };
+const int IRRADIANCE_CACHE_LEVELS = sizeof(IRRADIANCE_CACHE_STRIDES) / sizeof(int);
+const float IRRADIANCE_ERROR_THRESHOLD = 0.25f;
+const float IRRADIANCE_CACHE_MARGIN = 1.f;
 
-Camera::Camera(Vertex eye_pos1, Vertex eye_pos2, Direction direction, Direction up_vector) :
-    direction_(direction), up_vector_(up_vector), framebuffer_(WIDTH, std::vector<Pixel>(HEIGHT)) {
+// Reprojected samples are kept if the old and the new first hit are at most
+// this many pixel footprints apart, and then at most this many of them
+const float REPROJECTION_TOLERANCE = 2.f;
+const int REPROJECTION_MAX_SAMPLES = 8;
+
+static unsigned int HashMix(unsigned int h) {
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+static int CurrentThread() {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+static int MaxThreads() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+// Seed of the random sequence used by one sample of one pixel
+static unsigned int SampleSeed(unsigned int seed, int x, int y, int sample) {
+  unsigned int h = HashMix(seed + 0x9e3779b9u);
+  h = HashMix(h ^ (unsigned int)x);
+  h = HashMix(h ^ (unsigned int)y);
+  return HashMix(h ^ (unsigned int)sample);
+}
+
+Camera::Camera(Vertex eye_pos1, Vertex eye_pos2, Direction direction, Direction up_vector,
+               int width /* = WIDTH */, int height /* = HEIGHT */) :
+    direction_(direction), up_vector_(up_vector), width_(width), height_(height),
+    seed_(0), first_sample_(0), samples_rendered_(0), tile_partition_index_(0),
+    tile_partition_count_(1), merged_spp_(0), checkpoint_interval_(0), use_irradiance_cache_(false),
+    caustic_photons_(0), numa_pinning_(false), numa_replica_version_(-1), integrator_(INTEGRATOR_RAYTRACE), setup_seconds_(0.), pass_seconds_(0.),
+    framebuffer_(width, std::vector<Pixel>(height)),
+    other_eye_framebuffer_(width, std::vector<Pixel>(height)) {
   pos_idx_ = 0;
   eye_pos_[0] = eye_pos1;
   eye_pos_[1] = eye_pos2;
@@ -26,20 +88,96 @@ Camera::Camera(Vertex eye_pos1, Vertex eye_pos2, Direction direction, Direction
   camera_plane_[2] = Vertex(0.f, 1.f, 1.f);
   camera_plane_[3] = Vertex(0.f,-1.f, 1.f);
 
-  delta_ = (camera_plane_[1].y - camera_plane_[0].y)/WIDTH;
+  // The plane is always 2 units wide, a non-square image gets square pixels
+  // by being cropped or extended vertically
+  delta_ = (camera_plane_[1].y - camera_plane_[0].y)/width_;
   pixel_center_minimum_ = camera_plane_[0].y + delta_/2;
+  pixel_center_minimum_z_ = camera_plane_[0].z * height_ / width_ + delta_/2;
 }
 
+Camera::~Camera() = default;
+Camera::Camera(Camera&& other) = default;
+Camera& Camera::operator=(Camera&& other) = default;
+
 void Camera::ChangeEyePos() {
   pos_idx_ = (pos_idx_ == 0) ? 1 : 0 ;
+  std::swap(framebuffer_, other_eye_framebuffer_);
+  first_hits_.clear();
+}
+
+void Camera::FindFirstHits(Scene& scene, Vertex eye, std::vector<FirstHit>& hits) {
+  hits.resize(width_ * height_);
+  #pragma omp parallel
+  {
+    Raytracer raytracer;
+    #pragma omp for schedule(dynamic, 64)
+    for (int idx = 0; idx < width_ * height_; idx++) {
+      int x = idx / height_;
+      int y = idx % height_;
+      Vertex pixel_center = Vertex(0, x * delta_ + pixel_center_minimum_, y * delta_ + pixel_center_minimum_z_);
+      Ray ray = Ray(pixel_center, pixel_center - eye);
+      bool diffuse = false;
+      hits[idx].reusable = raytracer.FindFirstHit(ray, scene, hits[idx].position, diffuse) && diffuse;
+    }
+  }
+}
+
+bool Camera::ProjectToPixel(Vertex eye, Vertex position, int& x, int& y) {
+  Direction direction = position - eye;
+  if (direction.x <= 0.f) {
+    return false; // not in front of the image plane
+  }
+  float s = -eye.x / direction.x;
+  x = (int)std::lround((eye.y + s * direction.y - pixel_center_minimum_) / delta_);
+  y = (int)std::lround((eye.z + s * direction.z - pixel_center_minimum_z_) / delta_);
+  return x >= 0 && x < width_ && y >= 0 && y < height_;
+}
+
+float Camera::MoveEye(Scene& scene, Vertex eye_pos) {
+  Vertex old_eye = eye_pos_[pos_idx_];
+  if (first_hits_.empty()) {
+    FindFirstHits(scene, old_eye, first_hits_);
+  }
+  std::vector<FirstHit> hits;
+  FindFirstHits(scene, eye_pos, hits);
+
+  Framebuffer framebuffer(width_, std::vector<Pixel>(height_));
+  long long reused = 0;
+  #pragma omp parallel for reduction(+:reused)
+  for (int x = 0; x < width_; x++) {
+    for (int y = 0; y < height_; y++) {
+      const FirstHit& hit = hits[x * height_ + y];
+      int old_x, old_y;
+      if (!hit.reusable || !ProjectToPixel(old_eye, hit.position, old_x, old_y)) {
+        continue;
+      }
+      // A different surface, or the same one too far off, at the old pixel
+      // means the point was hidden or is at an edge
+      const FirstHit& old_hit = first_hits_[old_x * height_ + old_y];
+      Vertex pixel_center = Vertex(0, x * delta_ + pixel_center_minimum_, y * delta_ + pixel_center_minimum_z_);
+      float footprint = delta_ * glm::length(hit.position - eye_pos) / glm::length(pixel_center - eye_pos);
+      Pixel& old_pixel = framebuffer_[old_x][old_y];
+      if (!old_hit.reusable || old_pixel.get_samples() == 0 ||
+          glm::length(old_hit.position - hit.position) > REPROJECTION_TOLERANCE * footprint) {
+        continue;
+      }
+      unsigned int samples = std::min(old_pixel.get_samples(), (unsigned int)REPROJECTION_MAX_SAMPLES);
+      framebuffer[x][y].AddSamples(old_pixel.get_color() * (float)samples, samples);
+      reused++;
+    }
+  }
+  framebuffer_.swap(framebuffer);
+  first_hits_.swap(hits);
+  eye_pos_[pos_idx_] = eye_pos;
+  return (float)reused / (width_ * height_);
 }
 
 double Camera::CalcMaxIntensity() {
   double max_intensity = -1.0;
 
   //TODO: Parallelize this?
-  for(int x = 0; x < WIDTH; x++) {
-    for(int y = 0; y < HEIGHT; y++) {
+  for(int x = 0; x < width_; x++) {
+    for(int y = 0; y < height_; y++) {
       max_intensity = fmax(framebuffer_[x][y].get_color().x, max_intensity);
       max_intensity = fmax(framebuffer_[x][y].get_color().y, max_intensity);
       max_intensity = fmax(framebuffer_[x][y].get_color().z, max_intensity);
@@ -53,8 +191,8 @@ void Camera::NormalizeByMaxIntensity(ImageRgb& image_rgb) {
   double normalizing_factor = 255.99/max_intensity;
 
   // TODO: Parallelize this?
-  for(int x = 0; x < WIDTH; x++) {
-    for(int y = 0; y < HEIGHT; y++) {
+  for(int x = 0; x < width_; x++) {
+    for(int y = 0; y < height_; y++) {
       image_rgb[x][y][0] = (int) framebuffer_[x][y].get_color().x * normalizing_factor;
       image_rgb[x][y][1] = (int) framebuffer_[x][y].get_color().y * normalizing_factor;
       image_rgb[x][y][2] = (int) framebuffer_[x][y].get_color().z * normalizing_factor;
@@ -64,8 +202,8 @@ void Camera::NormalizeByMaxIntensity(ImageRgb& image_rgb) {
 
 void Camera::NormalizeBySqrt(ImageRgb& image_rgb) {
   float gamma_factor_inv = 1.f / GAMMA_FACTOR;
-  for(int x = 0; x < WIDTH; x++) {
-    for(int y = 0; y < HEIGHT; y++) {
+  for(int x = 0; x < width_; x++) {
+    for(int y = 0; y < height_; y++) {
       float r = framebuffer_[x][y].get_color().x;
       float g = framebuffer_[x][y].get_color().y;
       float b = framebuffer_[x][y].get_color().z;
@@ -77,38 +215,398 @@ void Camera::NormalizeBySqrt(ImageRgb& image_rgb) {
 }
 
 void Camera::ClearColorBuffer(ColorDbl clear_color) {
-  for(int x = 0; x < WIDTH; x++) {
-    for(int y = 0; y < HEIGHT; y++) {
+  for(int x = 0; x < width_; x++) {
+    for(int y = 0; y < height_; y++) {
       framebuffer_[x][y].set_color(clear_color);
+      other_eye_framebuffer_[x][y].set_color(clear_color);
     }
   }
+  samples_rendered_ = first_sample_;
+  tile_costs_.clear();
 }
 
-void Camera::Render(Scene& scene, int spp /* = 1 */) {
-  float factor = ((float)RAND_MAX) / delta_;
+void Camera::set_tile_partition(int index, int count) {
+  assert(count > 0 && index >= 0 && index < count);
+  tile_partition_index_ = index;
+  tile_partition_count_ = count;
+}
+
+ColorDbl Camera::RenderSample(Raytracer& raytracer, Scene& scene, int eye, int x, int y, int sample) {
+  raytracer.Seed(SampleSeed(seed_, x, y, sample));
   float delta2 = delta_ - (delta_ / 2.f);
-  Raytracer raytracer;
-  #pragma omp parallel for schedule(dynamic, 1)
-  for (int i = 0; i < WIDTH; i++) {
-    fprintf(stderr, "\r\tProgress:  %1.2f%%", 100.*i/(WIDTH-1));
-    for (int j = 0; j < HEIGHT; j++) {
-      ColorDbl temp_color =  COLOR_BLACK;
-      for (int s = 0; s < spp; s++ ) {
-        float random_y = distribution(generator) * delta2;
-        float random_z = distribution(generator) * delta2;
-       
-        Vertex pixel_center = Vertex(0, i * delta_ + pixel_center_minimum_ + random_y, j * delta_ + pixel_center_minimum_ + random_z);
-        Ray ray = Ray(pixel_center, pixel_center - eye_pos_[pos_idx_]);
-        temp_color = temp_color + raytracer.Raytrace(ray, scene, 0);
+  float random_y = raytracer.Random() * delta2;
+  float random_z = raytracer.Random() * delta2;
+
+  Vertex pixel_center = Vertex(0, x * delta_ + pixel_center_minimum_ + random_y, y * delta_ + pixel_center_minimum_z_ + random_z);
+  Ray ray = Ray(pixel_center, pixel_center - eye_pos_[eye]);
+  if (integrator_ == INTEGRATOR_BIDIRECTIONAL) {
+    return raytracer.TraceBidirectional(ray, scene);
+  }
+  return raytracer.Raytrace(ray, scene, 0);
+}
+
+void Camera::RenderTile(Raytracer& raytracer, Scene& scene, int tile, int sample, bool stereo) {
+  const int tiles_x = (width_ + TILE_SIZE - 1) / TILE_SIZE;
+  int x0 = (tile % tiles_x) * TILE_SIZE;
+  int y0 = (tile / tiles_x) * TILE_SIZE;
+  auto start = std::chrono::steady_clock::now();
+  long long rays = raytracer.get_rays();
+  for (int i = x0; i < x0 + TILE_SIZE && i < width_; i++) {
+    for (int j = y0; j < y0 + TILE_SIZE && j < height_; j++) {
+      framebuffer_[i][j].AddSamples(RenderSample(raytracer, scene, pos_idx_, i, j, sample), 1);
+      // Same seed for both eyes: identical jitter and bounce directions
+      // keep the noise consistent between the views, and both rays
+      // reuse the scene data the first one just pulled into cache
+      if (stereo) {
+        other_eye_framebuffer_[i][j].AddSamples(
+            RenderSample(raytracer, scene, 1 - pos_idx_, i, j, sample), 1);
+      }
+    }
+  }
+  // Only the thread rendering the tile touches its cost during a pass
+  tile_costs_[tile].seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  tile_costs_[tile].rays += raytracer.get_rays() - rays;
+}
+
+// Reports every 0.1%, called by all render threads
+void Camera::ReportProgress(long long done, long long total) {
+  if (1000 * done / total == 1000 * (done - 1) / total) {
+    return;
+  }
+  if (progress_callback_) {
+    #pragma omp critical(camera_progress)
+    progress_callback_((double)done / total);
+  } else {
+    fprintf(stderr, "\r\tProgress:  %1.2f%%", 100. * done / total);
+  }
+}
+
+void Camera::Render(Scene& scene, int spp /* = 1 */) {
+  RenderPasses(scene, spp, false);
+}
+
+void Camera::RenderStereo(Scene& scene, int spp /* = 1 */) {
+  RenderPasses(scene, spp, true);
+}
+
+void Camera::RenderPasses(Scene& scene, int spp, bool stereo) {
+  const int tiles_x = (width_ + TILE_SIZE - 1) / TILE_SIZE;
+  const int tiles_y = (height_ + TILE_SIZE - 1) / TILE_SIZE;
+  const int tile_count = tiles_x * tiles_y;
+  const int target_spp = samples_rendered_ + spp;
+  const int owned_tile_count = (tile_count - tile_partition_index_ + tile_partition_count_ - 1) /
+      tile_partition_count_;
+  if ((int)tile_costs_.size() != tile_count) {
+    tile_costs_.assign(tile_count, TileCost());
+  }
+  auto setup_start = std::chrono::steady_clock::now();
+
+  // Checkpoints are written on a separate thread, the destructor waits for
+  // the last one to hit the disk
+  std::unique_ptr<CheckpointWriter> checkpoint_writer;
+  if (!checkpoint_path_.empty() && !stereo) {
+    checkpoint_writer.reset(new CheckpointWriter(checkpoint_path_));
+  }
+  auto last_checkpoint = std::chrono::steady_clock::now();
+
+  std::unique_ptr<PhotonMap> caustic_map;
+  if (caustic_photons_ > 0 && integrator_ == INTEGRATOR_RAYTRACE) {
+    fprintf(stderr, "\tTracing caustic photons...");
+    caustic_map = PhotonMap::BuildCausticMap(scene, caustic_photons_, HashMix(seed_ ^ 0x68e31da4u));
+    fprintf(stderr, " %d stored\n", (int)caustic_map->get_size());
+  }
+  std::unique_ptr<IrradianceCache> irradiance_cache;
+  if (use_irradiance_cache_ && integrator_ == INTEGRATOR_RAYTRACE) {
+    irradiance_cache = BuildIrradianceCache(scene, stereo, caustic_map.get());
+  }
+
+  // NUMA: every node renders the tiles in its own band of columns with its
+  // own copy of the scene, and steals from the other nodes when it is done.
+  // Threads are pinned round robin over the nodes, so a thread count below
+  // the number of CPUs is still spread evenly
+  struct TileQueue {
+    std::atomic<int> next;
+    char padding[60]; // keep the counters of different nodes apart
+    std::vector<int> tiles;
+  };
+  NumaTopology topology = numa_pinning_ ? NumaTopology::Detect() : NumaTopology();
+  int node_count = numa_pinning_ ? topology.get_node_count() : 1;
+  std::vector<TileQueue> queues(node_count);
+  std::vector<int> thread_cpus, thread_nodes;
+  if (numa_pinning_) {
+    if ((int)numa_replicas_.size() != node_count || numa_replica_version_ != scene.get_version()) {
+      numa_replicas_.clear();
+      numa_replicas_.resize(node_count);
+      numa_replica_version_ = scene.get_version();
+    }
+    for (int tile = tile_partition_index_; tile < tile_count; tile += tile_partition_count_) {
+      queues[(long long)(tile % tiles_x) * node_count / tiles_x].tiles.push_back(tile);
+    }
+    size_t max_threads = MaxThreads();
+    for (size_t index = 0; thread_cpus.size() < max_threads; index++) {
+      size_t assigned = thread_cpus.size();
+      for (int node = 0; node < node_count && thread_cpus.size() < max_threads; node++) {
+        if (index < topology.get_cpus(node).size()) {
+          thread_cpus.push_back(topology.get_cpus(node)[index]);
+          thread_nodes.push_back(node);
+        }
+      }
+      if (thread_cpus.size() == assigned) {
+        break; // every CPU has a thread
+      }
+    }
+    // The first thread of every node copies the scene if it has no copy yet
+    // and moves the node's framebuffer columns, so the pages are first
+    // touched from that node
+    #pragma omp parallel num_threads((int)thread_cpus.size())
+    {
+      int thread = CurrentThread();
+      NumaTopology::PinThread(thread_cpus[thread]);
+      int node = thread_nodes[thread];
+      if (thread == node) {
+        if (!numa_replicas_[node]) {
+          numa_replicas_[node] = scene.Clone();
+        }
+        for (int x = (long long)node * tiles_x / node_count * TILE_SIZE;
+             x < std::min(width_, (int)((long long)(node + 1) * tiles_x / node_count * TILE_SIZE)); x++) {
+          std::vector<Pixel> column(framebuffer_[x]);
+          framebuffer_[x].swap(column);
+          std::vector<Pixel> other_column(other_eye_framebuffer_[x]);
+          other_eye_framebuffer_[x].swap(other_column);
+        }
+      }
+    }
+  }
+  auto passes_start = std::chrono::steady_clock::now();
+  setup_seconds_ = std::chrono::duration<double>(passes_start - setup_start).count();
+
+  // One pass adds one sample to every pixel, so a checkpoint taken between
+  // two passes leaves every pixel with the same number of samples
+  std::atomic<long long> tiles_done(0);
+  std::atomic<long long> self_hits(0), leaks(0);
+  long long total = (long long)owned_tile_count * spp;
+  for (int sample = samples_rendered_; sample < target_spp; sample++) {
+    if (numa_pinning_) {
+      for (TileQueue& queue : queues) {
+        queue.next = 0;
+      }
+      #pragma omp parallel num_threads((int)thread_cpus.size())
+      {
+        int thread = CurrentThread();
+        NumaTopology::PinThread(thread_cpus[thread]);
+        int node = thread_nodes[thread];
+        // A node gets no replica if OpenMP gave us fewer threads than asked for
+        Scene& local_scene = numa_replicas_[node] ? *numa_replicas_[node] : scene;
+        Raytracer raytracer;
+        raytracer.set_irradiance_cache(irradiance_cache.get());
+        raytracer.set_caustic_map(caustic_map.get());
+        for (int k = 0; k < node_count; k++) {
+          TileQueue& queue = queues[(node + k) % node_count];
+          for (int idx = queue.next++; idx < (int)queue.tiles.size(); idx = queue.next++) {
+            RenderTile(raytracer, local_scene, queue.tiles[idx], sample, stereo);
+            ReportProgress(++tiles_done, total);
+          }
+        }
+        self_hits += raytracer.get_self_hits();
+        leaks += raytracer.get_leaks();
+      }
+    } else {
+      #pragma omp parallel
+      {
+        Raytracer raytracer;
+        raytracer.set_irradiance_cache(irradiance_cache.get());
+        raytracer.set_caustic_map(caustic_map.get());
+        #pragma omp for schedule(dynamic, 1)
+        for (int tile = tile_partition_index_; tile < tile_count; tile += tile_partition_count_) {
+          RenderTile(raytracer, scene, tile, sample, stereo);
+          ReportProgress(++tiles_done, total);
+        }
+        self_hits += raytracer.get_self_hits();
+        leaks += raytracer.get_leaks();
       }
-      framebuffer_[i][j].set_color(temp_color / (float)spp);
     }
+    samples_rendered_ = sample + 1;
+
+    auto now = std::chrono::steady_clock::now();
+    if (checkpoint_writer && samples_rendered_ < target_spp &&
+        std::chrono::duration<double>(now - last_checkpoint).count() >= checkpoint_interval_) {
+      checkpoint_writer->Submit(CreateCheckpoint(target_spp));
+      last_checkpoint = now;
+    }
+  }
+  pass_seconds_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - passes_start).count();
+  if (checkpoint_writer) {
+    checkpoint_writer->Submit(CreateCheckpoint(target_spp));
+  }
+  if (self_hits > 0 || leaks > 0) {
+    fprintf(stderr, "\n\tLost rays: %lld hit the surface they started on, %lld left the scene\n",
+            (long long)self_hits, (long long)leaks);
   }
 }
 
-void Camera::CreateImage(std::string filename, const bool& normalize_intensities) {
-  ImageRgb image_rgb (WIDTH,std::vector<std::vector<int>>(HEIGHT,std::vector<int>(3)));
-  filename = "results/" + filename + "_" + std::to_string(WIDTH) + "x" + std::to_string(HEIGHT);
+std::unique_ptr<IrradianceCache> Camera::BuildIrradianceCache(Scene& scene, bool stereo,
+                                                              const PhotonMap* caustic_map) {
+  struct Candidate {
+    Vertex position;
+    Direction normal;
+    int level; // -1 if the pixel does not see a diffuse surface
+  };
+  const int stride = IRRADIANCE_CACHE_STRIDES[IRRADIANCE_CACHE_LEVELS - 1];
+  const int columns = (width_ + stride - 1) / stride;
+  const int rows = (height_ + stride - 1) / stride;
+  const int eyes = stereo ? 2 : 1;
+  std::vector<Candidate> candidates(eyes * columns * rows);
+
+  fprintf(stderr, "\tBuilding irradiance cache...");
+  #pragma omp parallel
+  {
+    Raytracer raytracer;
+    #pragma omp for schedule(dynamic, 64)
+    for (int idx = 0; idx < (int)candidates.size(); idx++) {
+      int eye = (idx / (columns * rows)) == 0 ? pos_idx_ : 1 - pos_idx_;
+      int x = (idx % (columns * rows)) / rows * stride;
+      int y = (idx % rows) * stride;
+      Candidate& candidate = candidates[idx];
+      candidate.level = -1;
+      Vertex pixel_center = Vertex(0, x * delta_ + pixel_center_minimum_, y * delta_ + pixel_center_minimum_z_);
+      Ray ray = Ray(pixel_center, pixel_center - eye_pos_[eye]);
+      if (raytracer.FindFirstDiffuseHit(ray, scene, candidate.position, candidate.normal)) {
+        for (int level = IRRADIANCE_CACHE_LEVELS - 1; level >= 0; level--) {
+          if (x % IRRADIANCE_CACHE_STRIDES[level] == 0 && y % IRRADIANCE_CACHE_STRIDES[level] == 0) {
+            candidate.level = level;
+          }
+        }
+      }
+    }
+  }
+
+  Vertex min = Vertex(FLT_MAX, FLT_MAX, FLT_MAX);
+  Vertex max = Vertex(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+  for (Candidate& candidate : candidates) {
+    if (candidate.level >= 0) {
+      min = glm::min(min, candidate.position);
+      max = glm::max(max, candidate.position);
+    }
+  }
+  if (min.x > max.x) {
+    return nullptr;
+  }
+  Direction margin = Direction(IRRADIANCE_CACHE_MARGIN, IRRADIANCE_CACHE_MARGIN, IRRADIANCE_CACHE_MARGIN);
+  std::unique_ptr<IrradianceCache> cache(
+      new IrradianceCache(min - margin, max + margin, IRRADIANCE_ERROR_THRESHOLD));
+
+  // Records are only added between levels, so all lookups within a level
+  // are read-only and need no locking
+  for (int level = 0; level < IRRADIANCE_CACHE_LEVELS; level++) {
+    std::vector<std::pair<int, IrradianceRecord>> new_records;
+    #pragma omp parallel
+    {
+      Raytracer raytracer;
+      raytracer.set_caustic_map(caustic_map);
+      std::vector<std::pair<int, IrradianceRecord>> thread_records;
+      #pragma omp for schedule(dynamic, 16)
+      for (int idx = 0; idx < (int)candidates.size(); idx++) {
+        Candidate& candidate = candidates[idx];
+        ColorDbl irradiance;
+        if (candidate.level != level ||
+            cache->Lookup(candidate.position, candidate.normal, irradiance)) {
+          continue;
+        }
+        raytracer.Seed(SampleSeed(seed_ ^ 0x5bd1e995u, idx, level, -1));
+        thread_records.push_back(std::make_pair(
+            idx, raytracer.ComputeIrradianceRecord(candidate.position, candidate.normal, scene)));
+      }
+      #pragma omp critical
+      new_records.insert(new_records.end(), thread_records.begin(), thread_records.end());
+    }
+    // Insert in a fixed order so the cache does not depend on the scheduling
+    std::sort(new_records.begin(), new_records.end(),
+              [](const std::pair<int, IrradianceRecord>& a,
+                 const std::pair<int, IrradianceRecord>& b) { return a.first < b.first; });
+    for (auto& record : new_records) {
+      cache->Add(record.second);
+    }
+  }
+  fprintf(stderr, " %d records\n", (int)cache->get_size());
+  return cache;
+}
+
+void Camera::EnableCheckpoints(std::string path, double interval_seconds) {
+  checkpoint_path_ = path;
+  checkpoint_interval_ = interval_seconds;
+}
+
+std::unique_ptr<Checkpoint> Camera::CreateCheckpoint(int target_spp) {
+  std::unique_ptr<Checkpoint> checkpoint(new Checkpoint());
+  checkpoint->width = width_;
+  checkpoint->height = height_;
+  checkpoint->seed = seed_;
+  checkpoint->eye_index = pos_idx_;
+  checkpoint->first_sample = first_sample_;
+  checkpoint->samples_rendered = samples_rendered_;
+  checkpoint->target_spp = target_spp;
+  checkpoint->tile_partition_index = tile_partition_index_;
+  checkpoint->tile_partition_count = tile_partition_count_;
+  checkpoint->partial = merged_spp_ > 0;
+  checkpoint->merged_spp = merged_spp_;
+  checkpoint->color_sums.resize(3 * width_ * height_);
+  checkpoint->sample_counts.resize(width_ * height_);
+  for (int x = 0; x < width_; x++) {
+    for (int y = 0; y < height_; y++) {
+      int idx = x * height_ + y;
+      glm::vec3 sum = framebuffer_[x][y].get_accumulated_color();
+      checkpoint->color_sums[3 * idx + 0] = sum.x;
+      checkpoint->color_sums[3 * idx + 1] = sum.y;
+      checkpoint->color_sums[3 * idx + 2] = sum.z;
+      checkpoint->sample_counts[idx] = framebuffer_[x][y].get_samples();
+    }
+  }
+  return checkpoint;
+}
+
+int Camera::ResumeFromCheckpoint(std::string path) {
+  std::unique_ptr<Checkpoint> checkpoint = Checkpoint::Load(path);
+  if (!checkpoint || checkpoint->width != width_ || checkpoint->height != height_) {
+    return -1;
+  }
+  ClearColorBuffer(COLOR_BLACK);
+  AddCheckpoint(*checkpoint);
+  seed_ = checkpoint->seed;
+  pos_idx_ = checkpoint->eye_index;
+  first_sample_ = checkpoint->first_sample;
+  samples_rendered_ = checkpoint->samples_rendered;
+  set_tile_partition(checkpoint->tile_partition_index, checkpoint->tile_partition_count);
+  merged_spp_ = checkpoint->partial ? std::max(1, checkpoint->merged_spp) : 0;
+  return std::max(0, checkpoint->target_spp - samples_rendered_);
+}
+
+bool Camera::MergePartialRender(std::string path, Checkpoint& header) {
+  std::unique_ptr<Checkpoint> checkpoint = Checkpoint::Load(path);
+  if (!checkpoint || checkpoint->width != width_ || checkpoint->height != height_) {
+    return false;
+  }
+  AddCheckpoint(*checkpoint);
+  checkpoint->color_sums = std::vector<float>();
+  checkpoint->sample_counts = std::vector<unsigned int>();
+  header = std::move(*checkpoint);
+  return true;
+}
+
+void Camera::AddCheckpoint(Checkpoint& checkpoint) {
+  for (int x = 0; x < width_; x++) {
+    for (int y = 0; y < height_; y++) {
+      int idx = x * height_ + y;
+      ColorDbl sum = ColorDbl(checkpoint.color_sums[3 * idx + 0],
+                              checkpoint.color_sums[3 * idx + 1],
+                              checkpoint.color_sums[3 * idx + 2]);
+      framebuffer_[x][y].AddSamples(sum, checkpoint.sample_counts[idx]);
+    }
+  }
+}
+
+std::string Camera::CreateImage(std::string filename, const bool& normalize_intensities) {
+  ImageRgb image_rgb (width_,std::vector<std::vector<int>>(height_,std::vector<int>(3)));
+  filename = "results/" + filename + "_" + std::to_string(width_) + "x" + std::to_string(height_);
   if (normalize_intensities) {
     NormalizeByMaxIntensity(image_rgb);
   } else {
@@ -119,15 +617,105 @@ void Camera::CreateImage(std::string filename, const bool& normalize_intensities
     filename += "_gamma" + ss.str();
   }
   filename = filename + ".ppm";
-  SaveImage(filename.c_str(), image_rgb);
+  if (!SaveImage(filename.c_str(), image_rgb)) {
+    std::cerr << "\nCould not write " << filename << std::endl;
+    return "";
+  }
+  return filename;
+}
+
+std::string Camera::CreateHdrImage(std::string filename) {
+  filename = "results/" + filename + "_" + std::to_string(width_) + "x" + std::to_string(height_);
+  bool ok = true;
+  if (!HdrImage::SavePfm((filename + ".pfm").c_str(), framebuffer_)) {
+    std::cerr << "\nCould not write " << filename << ".pfm" << std::endl;
+    ok = false;
+  }
+  if (!HdrImage::SaveTiledExr((filename + ".exr").c_str(), framebuffer_)) {
+    std::cerr << "\nCould not write " << filename << ".exr" << std::endl;
+    ok = false;
+  }
+  return ok ? filename + ".pfm" : "";
+}
+
+double Camera::EstimateRenderTime(Scene& scene, int spp, int pilot_spp, bool stereo) {
+  assert(pilot_spp > 0);
+  RenderPasses(scene, pilot_spp, stereo);
+  // The setup is done once per render, the passes scale with the samples
+  return setup_seconds_ + pass_seconds_ / pilot_spp * spp;
 }
 
-void Camera::SaveImage(const char* img_name,
-  ImageRgb& image) {
+// Black through blue, red and yellow to white
+static void HeatmapColor(float t, std::vector<int>& rgb) {
+  const float stops[5][3] = { {0, 0, 0}, {0, 0, 1}, {1, 0, 0}, {1, 1, 0}, {1, 1, 1} };
+  t = std::min(1.f, std::max(0.f, t)) * 4.f;
+  int i = std::min(3, (int)t);
+  float f = t - i;
+  for (int c = 0; c < 3; c++) {
+    rgb[c] = (int)(255.99f * ((1.f - f) * stops[i][c] + f * stops[i + 1][c]));
+  }
+}
+
+std::string Camera::CreateCostMap(std::string filename) {
+  const int tiles_x = (width_ + TILE_SIZE - 1) / TILE_SIZE;
+  filename = "results/" + filename + "_" + std::to_string(width_) + "x" + std::to_string(height_);
+  std::string csv_path = filename + ".csv";
+  FILE* fp = fopen(csv_path.c_str(), "w");
+  if (!fp) {
+    std::cerr << "\nCould not write " << csv_path << std::endl;
+    return "";
+  }
+  // Edge tiles are smaller, so the heatmap compares the time per pixel,
+  // stretched from the cheapest to the most expensive tile
+  fprintf(fp, "tile_x,tile_y,x,y,width,height,seconds,rays\n");
+  std::vector<double> pixel_seconds(tile_costs_.size());
+  double min_pixel_seconds = DBL_MAX;
+  double max_pixel_seconds = 0.;
+  for (int tile = 0; tile < (int)tile_costs_.size(); tile++) {
+    int x0 = (tile % tiles_x) * TILE_SIZE;
+    int y0 = (tile / tiles_x) * TILE_SIZE;
+    int tile_width = std::min(TILE_SIZE, width_ - x0);
+    int tile_height = std::min(TILE_SIZE, height_ - y0);
+    fprintf(fp, "%d,%d,%d,%d,%d,%d,%.6f,%lld\n", tile % tiles_x, tile / tiles_x, x0, y0,
+            tile_width, tile_height, tile_costs_[tile].seconds, tile_costs_[tile].rays);
+    pixel_seconds[tile] = tile_costs_[tile].seconds / (tile_width * tile_height);
+    if (tile_costs_[tile].seconds > 0.) {
+      min_pixel_seconds = std::min(min_pixel_seconds, pixel_seconds[tile]);
+      max_pixel_seconds = std::max(max_pixel_seconds, pixel_seconds[tile]);
+    }
+  }
+  if (fclose(fp) != 0) {
+    std::cerr << "\nCould not write " << csv_path << std::endl;
+    return "";
+  }
+
+  ImageRgb image_rgb(width_, std::vector<std::vector<int>>(height_, std::vector<int>(3)));
+  for (int x = 0; x < width_; x++) {
+    for (int y = 0; y < height_; y++) {
+      int tile = (y / TILE_SIZE) * tiles_x + x / TILE_SIZE;
+      float t = tile < (int)pixel_seconds.size() && max_pixel_seconds > min_pixel_seconds ?
+          (float)((pixel_seconds[tile] - min_pixel_seconds) / (max_pixel_seconds - min_pixel_seconds)) : 0.f;
+      HeatmapColor(t, image_rgb[x][y]);
+    }
+  }
+  std::string ppm_path = filename + ".ppm";
+  if (!SaveImage(ppm_path.c_str(), image_rgb)) {
+    std::cerr << "\nCould not write " << ppm_path << std::endl;
+    return "";
+  }
+  return csv_path;
+}
+
+bool Camera::SaveImage(const char* img_name, ImageRgb& image) {
   FILE* fp = fopen(img_name, "wb"); /* b - binary mode */
-  (void)fprintf(fp, "P6\n%d %d\n255\n", WIDTH, HEIGHT);
-  for (int i = WIDTH - 1; i >= 0; i--) {
-    for (int j = HEIGHT - 1; j >= 0; j--) {
+  if (!fp) {
+    return false;
+  }
+  int width = image.size();
+  int height = width > 0 ? image[0].size() : 0;
+  (void)fprintf(fp, "P6\n%d %d\n255\n", width, height);
+  for (int i = height - 1; i >= 0; i--) {
+    for (int j = width - 1; j >= 0; j--) {
       static unsigned char color[3];
       color[0] = image[j][i][0]; // red
       color[1] = image[j][i][1]; // green
@@ -135,4 +723,5 @@ void Camera::SaveImage(const char* img_name,
       (void)fwrite(color, 1, 3, fp);
     }
   }
-}
\ No newline at end of file
+  return fclose(fp) == 0;
+}
@@ -0,0 +1,122 @@
+#include "checkpoint.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <iostream>
+
+const char CHECKPOINT_MAGIC[8] = { 'G', 'I', 'R', 'A', 'Y', 'C', 'P', '\0' };
+const uint32_t CHECKPOINT_VERSION = 4;
+
+bool Checkpoint::Save(const std::string& path) const {
+  std::string tmp_path = path + ".tmp";
+  FILE* fp = fopen(tmp_path.c_str(), "wb");
+  if (!fp) {
+    return false;
+  }
+  int32_t header[11] = { width, height, (int32_t)seed, eye_index, first_sample, samples_rendered,
+                         target_spp, tile_partition_index, tile_partition_count, partial ? 1 : 0,
+                         merged_spp };
+  bool ok = fwrite(CHECKPOINT_MAGIC, 1, sizeof(CHECKPOINT_MAGIC), fp) == sizeof(CHECKPOINT_MAGIC);
+  ok = ok && fwrite(&CHECKPOINT_VERSION, sizeof(CHECKPOINT_VERSION), 1, fp) == 1;
+  ok = ok && fwrite(header, sizeof(header), 1, fp) == 1;
+  ok = ok && fwrite(color_sums.data(), sizeof(float), color_sums.size(), fp) == color_sums.size();
+  ok = ok && fwrite(sample_counts.data(), sizeof(unsigned int), sample_counts.size(), fp) ==
+      sample_counts.size();
+  ok = (fclose(fp) == 0) && ok;
+  if (!ok) {
+    remove(tmp_path.c_str());
+    return false;
+  }
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    // Windows does not replace existing files on rename
+    remove(path.c_str());
+    return rename(tmp_path.c_str(), path.c_str()) == 0;
+  }
+  return true;
+}
+
+std::unique_ptr<Checkpoint> Checkpoint::Load(const std::string& path) {
+  FILE* fp = fopen(path.c_str(), "rb");
+  if (!fp) {
+    return nullptr;
+  }
+  char magic[sizeof(CHECKPOINT_MAGIC)];
+  uint32_t version;
+  int32_t header[11];
+  if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+      memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 ||
+      fread(&version, sizeof(version), 1, fp) != 1 || version != CHECKPOINT_VERSION ||
+      fread(header, sizeof(header), 1, fp) != 1 || header[0] <= 0 || header[1] <= 0) {
+    fclose(fp);
+    return nullptr;
+  }
+  std::unique_ptr<Checkpoint> checkpoint(new Checkpoint());
+  checkpoint->width = header[0];
+  checkpoint->height = header[1];
+  checkpoint->seed = (unsigned int)header[2];
+  checkpoint->eye_index = header[3];
+  checkpoint->first_sample = header[4];
+  checkpoint->samples_rendered = header[5];
+  checkpoint->target_spp = header[6];
+  checkpoint->tile_partition_index = header[7];
+  checkpoint->tile_partition_count = header[8];
+  checkpoint->partial = header[9] != 0;
+  checkpoint->merged_spp = header[10];
+  // Resuming indexes the eye positions and strides over the tiles with these
+  if (checkpoint->eye_index < 0 || checkpoint->eye_index > 1 ||
+      checkpoint->tile_partition_index < 0 ||
+      checkpoint->tile_partition_index >= checkpoint->tile_partition_count ||
+      checkpoint->first_sample < 0 || checkpoint->samples_rendered < 0 || checkpoint->target_spp < 0 ||
+      checkpoint->merged_spp < 0) {
+    fclose(fp);
+    return nullptr;
+  }
+  size_t pixels = (size_t)checkpoint->width * checkpoint->height;
+  checkpoint->color_sums.resize(3 * pixels);
+  checkpoint->sample_counts.resize(pixels);
+  bool ok = fread(checkpoint->color_sums.data(), sizeof(float), 3 * pixels, fp) == 3 * pixels &&
+      fread(checkpoint->sample_counts.data(), sizeof(unsigned int), pixels, fp) == pixels;
+  fclose(fp);
+  if (!ok) {
+    return nullptr;
+  }
+  return checkpoint;
+}
+
+CheckpointWriter::CheckpointWriter(std::string path) : path_(path), stop_(false) {
+  thread_ = std::thread(&CheckpointWriter::Run, this);
+}
+
+CheckpointWriter::~CheckpointWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  condition_.notify_one();
+  thread_.join();
+}
+
+void CheckpointWriter::Submit(std::unique_ptr<Checkpoint> checkpoint) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_ = std::move(checkpoint);
+  }
+  condition_.notify_one();
+}
+
+void CheckpointWriter::Run() {
+  while (true) {
+    std::unique_ptr<Checkpoint> checkpoint;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [this] { return pending_ || stop_; });
+      if (!pending_) {
+        return;
+      }
+      checkpoint = std::move(pending_);
+    }
+    if (!checkpoint->Save(path_)) {
+      std::cerr << "\nCould not write checkpoint " << path_ << std::endl;
+    }
+  }
+}
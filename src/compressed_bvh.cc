@@ -0,0 +1,175 @@
+#include "compressed_bvh.h"
+#include <cmath>
+#include <string.h>
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define COMPRESSED_BVH_SSE2
+#endif
+
+const int NODE_ALIGNMENT = 64;
+
+// Rounds the child box outwards to the grid of the parent, one axis at a time
+static void Quantize(float origin, float scale, float min, float max, uint8_t& lower, uint8_t& upper) {
+  if (scale <= 0.f) {
+    lower = 0;
+    upper = 0;
+    return;
+  }
+  int q_lower = std::max(0, std::min(255, (int)floorf((min - origin) / scale)));
+  while (q_lower > 0 && origin + q_lower * scale > min) {
+    q_lower--;
+  }
+  int q_upper = std::max(0, std::min(255, (int)ceilf((max - origin) / scale)));
+  while (q_upper < 255 && origin + q_upper * scale < max) {
+    q_upper++;
+  }
+  lower = (uint8_t)q_lower;
+  upper = (uint8_t)q_upper;
+}
+
+CompressedBvh::CompressedBvh(const CompressedBvh& other)
+    : indices_(other.indices_), bounds_(other.bounds_) {
+  StoreNodes(other.nodes_, other.node_count_);
+}
+
+CompressedBvh& CompressedBvh::operator=(const CompressedBvh& other) {
+  if (this != &other) {
+    indices_ = other.indices_;
+    bounds_ = other.bounds_;
+    StoreNodes(other.nodes_, other.node_count_);
+  }
+  return *this;
+}
+
+void CompressedBvh::StoreNodes(const CompressedBvhNode* nodes, int node_count) {
+  node_count_ = node_count;
+  storage_.reset(new char[node_count_ * sizeof(CompressedBvhNode) + NODE_ALIGNMENT]);
+  uintptr_t address = (uintptr_t)storage_.get();
+  nodes_ = (CompressedBvhNode*)((address + NODE_ALIGNMENT - 1) & ~(uintptr_t)(NODE_ALIGNMENT - 1));
+  if (node_count_ > 0) {
+    memcpy(nodes_, nodes, node_count_ * sizeof(CompressedBvhNode));
+  }
+}
+
+void CompressedBvh::Build(const Bvh& bvh) {
+  const std::vector<BvhNode>& binary_nodes = bvh.get_nodes();
+  indices_ = bvh.get_indices();
+  bounds_ = bvh.get_bounds();
+  std::vector<CompressedBvhNode> nodes;
+  // Binary node each wide node is collapsed from
+  std::vector<int> sources;
+  if (!binary_nodes.empty()) {
+    nodes.emplace_back();
+    sources.push_back(0);
+  }
+  for (size_t wide = 0; wide < nodes.size(); wide++) {
+    // Open up the largest inner child until there are four children
+    int children[4];
+    int child_count = 0;
+    const BvhNode& source = binary_nodes[sources[wide]];
+    if (source.count > 0) {
+      children[child_count++] = sources[wide]; // a root that is a leaf
+    } else {
+      children[child_count++] = source.left_first;
+      children[child_count++] = source.left_first + 1;
+    }
+    while (child_count < 4) {
+      int largest = -1;
+      float largest_area = -1.f;
+      for (int i = 0; i < child_count; i++) {
+        const BvhNode& child = binary_nodes[children[i]];
+        if (child.count == 0 && child.bounds.SurfaceArea() > largest_area) {
+          largest = i;
+          largest_area = child.bounds.SurfaceArea();
+        }
+      }
+      if (largest < 0) {
+        break;
+      }
+      int opened = children[largest];
+      children[largest] = binary_nodes[opened].left_first;
+      children[child_count++] = binary_nodes[opened].left_first + 1;
+    }
+
+    Aabb parent_bounds;
+    for (int i = 0; i < child_count; i++) {
+      parent_bounds.Extend(binary_nodes[children[i]].bounds);
+    }
+    CompressedBvhNode node;
+    memset(&node, 0, sizeof(node));
+    for (int axis = 0; axis < 3; axis++) {
+      float extent = parent_bounds.max[axis] - parent_bounds.min[axis];
+      float scale = extent / 255.f;
+      while (scale > 0.f && parent_bounds.min[axis] + 255.f * scale < parent_bounds.max[axis]) {
+        scale = nextafterf(scale, FLT_MAX);
+      }
+      node.origin[axis] = parent_bounds.min[axis];
+      node.scale[axis] = scale;
+    }
+    for (int i = 0; i < child_count; i++) {
+      const BvhNode& child = binary_nodes[children[i]];
+      for (int axis = 0; axis < 3; axis++) {
+        Quantize(node.origin[axis], node.scale[axis], child.bounds.min[axis], child.bounds.max[axis],
+                 node.lower[axis][i], node.upper[axis][i]);
+      }
+      if (child.count > 0) {
+        node.children[i] = ~(child.left_first << 3 | (child.count - 1));
+      } else {
+        node.children[i] = nodes.size();
+        nodes.emplace_back();
+        sources.push_back(children[i]);
+      }
+    }
+    nodes[wide] = node;
+  }
+
+  StoreNodes(nodes.data(), nodes.size());
+}
+
+#ifdef COMPRESSED_BVH_SSE2
+// Four 8 bit values to four floats
+static inline __m128 LoadQuantized(const uint8_t* values) {
+  int packed;
+  memcpy(&packed, values, sizeof(packed));
+  __m128i zero = _mm_setzero_si128();
+  __m128i bytes = _mm_cvtsi32_si128(packed);
+  return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero));
+}
+
+int CompressedBvh::IntersectChildren(const CompressedBvhNode& node, Vertex origin, Direction inverse_direction,
+                                     float t_max, float t_near[4]) const {
+  __m128 t_enter = _mm_setzero_ps();
+  __m128 t_exit = _mm_set1_ps(t_max);
+  for (int axis = 0; axis < 3; axis++) {
+    // origin + q * scale, turned into a distance along the ray
+    __m128 step = _mm_set1_ps(node.scale[axis] * inverse_direction[axis]);
+    __m128 offset = _mm_set1_ps((node.origin[axis] - origin[axis]) * inverse_direction[axis]);
+    __m128 t0 = _mm_add_ps(_mm_mul_ps(LoadQuantized(node.lower[axis]), step), offset);
+    __m128 t1 = _mm_add_ps(_mm_mul_ps(LoadQuantized(node.upper[axis]), step), offset);
+    t_enter = _mm_max_ps(t_enter, _mm_min_ps(t0, t1));
+    t_exit = _mm_min_ps(t_exit, _mm_max_ps(t0, t1));
+  }
+  _mm_storeu_ps(t_near, t_enter);
+  return _mm_movemask_ps(_mm_cmple_ps(t_enter, t_exit));
+}
+#else
+int CompressedBvh::IntersectChildren(const CompressedBvhNode& node, Vertex origin, Direction inverse_direction,
+                                     float t_max, float t_near[4]) const {
+  int hits = 0;
+  for (int i = 0; i < 4; i++) {
+    float t_enter = 0.f;
+    float t_exit = t_max;
+    for (int axis = 0; axis < 3; axis++) {
+      float step = node.scale[axis] * inverse_direction[axis];
+      float offset = (node.origin[axis] - origin[axis]) * inverse_direction[axis];
+      float t0 = node.lower[axis][i] * step + offset;
+      float t1 = node.upper[axis][i] * step + offset;
+      t_enter = std::max(t_enter, std::min(t0, t1));
+      t_exit = std::min(t_exit, std::max(t0, t1));
+    }
+    t_near[i] = t_enter;
+    hits |= (t_enter <= t_exit) << i;
+  }
+  return hits;
+}
+#endif
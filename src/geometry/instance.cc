@@ -0,0 +1,58 @@
+#include "instance.h"
+#include "ray.h"
+#include "intersection_point.h"
+
+Instance::Instance(const Mesh* mesh, glm::mat4 object_to_world)
+    : mesh_(mesh), placement_(object_to_world) {
+  set_transform(glm::mat4(1.f));
+}
+
+Instance::Instance(const Mesh* mesh, glm::mat4 object_to_world, Material material)
+    : Instance(mesh, object_to_world) {
+  has_material_ = true;
+  material_ = material;
+}
+
+IntersectionPoint* Instance::RayIntersection(Ray& ray, Arena& arena) {
+  // The direction is not renormalized, that way t is the same distance in
+  // both spaces even if the transform scales
+  Vertex origin = Vertex(world_to_object_ * glm::vec4(ray.get_origin(), 1.f));
+  Direction direction = Direction(world_to_object_ * glm::vec4(ray.get_direction(), 0.f));
+  float t = FLT_MAX;
+  int hit = mesh_->Intersect(origin, direction, t);
+  if (hit < 0) {
+    return nullptr;
+  }
+  const Triangle& triangle = mesh_->get_triangle(hit);
+  return arena.Create<IntersectionPoint>(ray.get_origin() + t * ray.get_direction(),
+                                         normal_to_world_ * triangle.get_normal(),
+                                         has_material_ ? &material_ : &triangle.get_material(), t);
+}
+
+void Instance::set_transform(const glm::mat4& transform) {
+  object_to_world_ = transform * placement_;
+  world_to_object_ = glm::inverse(object_to_world_);
+  normal_to_world_ = glm::transpose(glm::mat3(world_to_object_));
+  position_ = Vertex(object_to_world_ * glm::vec4(0.f, 0.f, 0.f, 1.f));
+}
+
+Aabb Instance::GetBounds() {
+  return mesh_->get_bounds().Transform(object_to_world_);
+}
+
+Instance* Instance::Clone(Arena& arena, const MeshCopies& meshes) const {
+  Instance* copy = arena.Create<Instance>(*this);
+  copy->mesh_ = meshes.at(mesh_);
+  return copy;
+}
+
+bool Instance::GetCausticBounds(Vertex& center, float& radius) {
+  bool caustic = has_material_ ? material_.get_type() != MATERIAL_LAMBERTIAN : mesh_->HasCausticMaterial();
+  if (!caustic) {
+    return false;
+  }
+  Aabb bounds = GetBounds();
+  center = bounds.Centroid();
+  radius = 0.5f * glm::length(bounds.max - bounds.min);
+  return true;
+}
@@ -0,0 +1,37 @@
+#include "mesh.h"
+
+Mesh::Mesh(std::vector<Triangle> triangles) : triangles_(std::move(triangles)) {
+  BuildBvh();
+}
+
+void Mesh::BuildBvh() {
+  std::vector<Aabb> bounds;
+  bounds.reserve(triangles_.size());
+  for (Triangle& triangle : triangles_) {
+    bounds.push_back(triangle.GetBounds());
+  }
+  Bvh bvh;
+  bvh.Build(bounds);
+  bvh_.Build(bvh);
+}
+
+bool Mesh::HasCausticMaterial() const {
+  for (const Triangle& triangle : triangles_) {
+    if (triangle.get_material().get_type() != MATERIAL_LAMBERTIAN) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int Mesh::Intersect(Vertex origin, Direction direction, float& t) const {
+  int closest = -1;
+  RayShear shear(direction);
+  bvh_.Traverse(origin, direction, t, [&](int primitive, float& t_max) {
+    if (triangles_[primitive].Intersect(origin, shear, t_max)) {
+      closest = primitive;
+    }
+    return false;
+  });
+  return closest;
+}
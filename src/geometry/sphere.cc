@@ -1,60 +1,82 @@
 #include "sphere.h"
 #include "ray.h"
 #include <iostream>
+#include <cmath>
+#include <cfloat>
 #include <intersection_point.h>
 
 Sphere::Sphere(Vertex position, float radius, ColorDbl color)
-    : SceneObject(position) {
-  assert(radius > 0);
-  radius_ = radius;
-  material_ = Material(0,1,0,color, glm::vec3(0,0,0));
+    : Sphere(position, radius, Material(0,1,0,color, glm::vec3(0,0,0))) {
 }
 
 Sphere::Sphere(Vertex position, float radius, Material material)
     : SceneObject(position), material_(material) {
   assert(radius > 0);
   radius_ = radius;
+  rest_position_ = position;
+  rest_radius_ = radius;
 }
 
-std::unique_ptr<IntersectionPoint>  Sphere::RayIntersection(Ray& ray) {
-  Direction L = ray.get_origin() - position_;
-  Direction dir = ray.get_direction();
-  float radius2 = radius_ * radius_;
-  float a = glm::dot(dir, dir);
-  float b = 2 * glm::dot(dir, L);
-  float c = glm::dot(L, L) - radius2;
-  float t0, t1;
-  if (!SolveQuadratic(a, b, c, t0, t1)) {
-    return nullptr;
+// Only uniform scaling keeps a sphere a sphere, so the scale is taken from
+// the first column
+void Sphere::set_transform(const glm::mat4& transform) {
+  position_ = Vertex(transform * glm::vec4(rest_position_, 1.f));
+  radius_ = rest_radius_ * glm::length(Direction(transform[0]));
+}
+
+Aabb Sphere::GetBounds() {
+  Direction extent = Direction(radius_, radius_, radius_);
+  return Aabb(position_ - extent, position_ + extent);
+}
+
+Sphere* Sphere::Clone(Arena& arena, const MeshCopies& /*meshes*/) const {
+  return arena.Create<Sphere>(*this);
+}
+
+// Geometric formulation of Haines et al., "Precision Improvements for
+// Ray/Sphere Intersection" (Ray Tracing Gems, 2019). The discriminant comes
+// from the distance between the center and the closest point on the ray,
+// which does not cancel out for small spheres far from the ray origin the
+// way b^2 - 4ac does. SphereSet does the same operations in the same order,
+// so both give identical hits
+bool Sphere::Intersect(Vertex origin, Direction direction, Vertex center, float radius, float& t) {
+  Direction f = origin - center;
+  float b = -(f.x * direction.x + f.y * direction.y + f.z * direction.z);
+  Direction l = f + b * direction;
+  float radius2 = radius * radius;
+  float discriminant = radius2 - (l.x * l.x + l.y * l.y + l.z * l.z);
+  if (!(discriminant >= 0.f)) {
+    return false;
   }
-  if (t0 < 0) {
-    if (t1 < 0) {
-      return nullptr;
-    }
-    t0 = t1;
+  float c = (f.x * f.x + f.y * f.y + f.z * f.z) - radius2;
+  float q = b + std::copysign(sqrtf(discriminant), b);
+  float t0 = c / q;
+  float t1 = q;
+  float t_near = t0 < t1 ? t0 : t1;
+  float t_far = t0 > t1 ? t0 : t1;
+  float t_hit = t_near > 0.f ? t_near : t_far;
+  if (t_hit > 0.f && t_hit < t) {
+    t = t_hit;
+    return true;
   }
-  Vertex intersection_point = ray.get_origin() + ray.get_direction() * t0;
+  return false;
+}
+
+IntersectionPoint* Sphere::RayIntersection(Ray& ray, Arena& arena) {
+  float t = FLT_MAX;
+  if (!Intersect(ray.get_origin(), ray.get_direction(), position_, radius_, t)) {
+    return nullptr;
+  }
+  Vertex intersection_point = ray.get_origin() + ray.get_direction() * t;
   Direction normal = intersection_point - position_;
-  return std::make_unique<IntersectionPoint>(intersection_point, normal, material_, t0);
+  return arena.Create<IntersectionPoint>(intersection_point, normal, &material_, t);
 }
 
-bool Sphere::SolveQuadratic(const float& a,
-                            const float& b,
-                            const float& c,
-                            float& x0,
-                            float& x1) {
-  float discr = b * b - 4 * a * c;
-  if (discr < 0) {
+bool Sphere::GetCausticBounds(Vertex& center, float& radius) {
+  if (material_.get_type() == MATERIAL_LAMBERTIAN) {
     return false;
-  } else if (discr == 0) {
-    x0 = x1 = -0.5 * b / a;
-  } else {
-    float q = (b > 0) ? -0.5 * (b + sqrt(discr)) : -0.5 * (b - sqrt(discr));
-    x0 = q / a;
-    x1 = c / q;
-  }
-  if (x0 > x1) {
-    std::swap(x0, x1);
   }
+  center = position_;
+  radius = radius_;
   return true;
 }
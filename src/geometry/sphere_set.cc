@@ -0,0 +1,235 @@
+#include "sphere_set.h"
+#include "ray.h"
+#include "bvh.h"
+#include <cassert>
+#include <cmath>
+#include <cfloat>
+#include <limits>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define SPHERE_SET_AVX2
+  #include <immintrin.h>
+#endif
+
+const int SPHERE_CLUSTER_SIZE = 8;
+
+SphereSet::SphereSet() : use_avx2_(HasAvx2()) {
+}
+
+bool SphereSet::HasAvx2() {
+#ifdef SPHERE_SET_AVX2
+  return __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+int SphereSet::AddMaterial(const Material& material) {
+  materials_.push_back(material);
+  return materials_.size() - 1;
+}
+
+void SphereSet::AddSphere(Vertex center, float radius, int material) {
+  assert(radius > 0 && material >= 0 && material < (int)materials_.size());
+  centers_.push_back(center);
+  radii_.push_back(radius);
+  sphere_materials_.push_back(material);
+}
+
+// Counts the spheres below every node of the BVH
+static int CountSpheres(const std::vector<BvhNode>& nodes, int node, std::vector<int>& counts) {
+  if (nodes[node].count > 0) {
+    counts[node] = nodes[node].count;
+  } else {
+    counts[node] = CountSpheres(nodes, nodes[node].left_first, counts) +
+        CountSpheres(nodes, nodes[node].left_first + 1, counts);
+  }
+  return counts[node];
+}
+
+// Every subtree of a BVH over the spheres that holds at most 8 of them
+// becomes a cluster (the SAH alone stops at much smaller leaves), and a
+// second BVH over the clusters is what gets traced
+void SphereSet::Build() {
+  std::vector<Aabb> sphere_bounds;
+  for (size_t i = 0; i < centers_.size(); i++) {
+    Direction extent = Direction(radii_[i], radii_[i], radii_[i]);
+    sphere_bounds.push_back(Aabb(centers_[i] - extent, centers_[i] + extent));
+  }
+  Bvh sphere_bvh;
+  sphere_bvh.Build(sphere_bounds);
+  const std::vector<BvhNode>& nodes = sphere_bvh.get_nodes();
+  const std::vector<int>& indices = sphere_bvh.get_indices();
+
+  clusters_.clear();
+  std::vector<Aabb> cluster_bounds;
+  if (!nodes.empty()) {
+    std::vector<int> counts(nodes.size());
+    CountSpheres(nodes, 0, counts);
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    std::vector<int> stack(1, 0);
+    while (!stack.empty()) {
+      int node = stack.back();
+      stack.pop_back();
+      if (counts[node] > SPHERE_CLUSTER_SIZE) {
+        stack.push_back(nodes[node].left_first);
+        stack.push_back(nodes[node].left_first + 1);
+        continue;
+      }
+      // The leaves below a node hold a contiguous range of indices, which
+      // starts at the first one of its leftmost leaf
+      int first = node;
+      while (nodes[first].count == 0) {
+        first = nodes[first].left_first;
+      }
+      SphereCluster cluster;
+      for (int lane = 0; lane < SPHERE_CLUSTER_SIZE; lane++) {
+        int sphere = lane < counts[node] ? indices[nodes[first].left_first + lane] : -1;
+        cluster.center_x[lane] = sphere >= 0 ? centers_[sphere].x : nan;
+        cluster.center_y[lane] = sphere >= 0 ? centers_[sphere].y : nan;
+        cluster.center_z[lane] = sphere >= 0 ? centers_[sphere].z : nan;
+        cluster.radius[lane] = sphere >= 0 ? radii_[sphere] : nan;
+        cluster.sphere[lane] = sphere;
+      }
+      clusters_.push_back(cluster);
+      cluster_bounds.push_back(nodes[node].bounds);
+    }
+  }
+  Bvh cluster_bvh;
+  cluster_bvh.Build(cluster_bounds);
+  bvh_.Build(cluster_bvh);
+}
+
+// Same operations in the same order as Sphere::Intersect(), and min/max
+// written like the AVX instructions, so both kernels agree to the bit
+int SphereSet::IntersectCluster(const SphereCluster& cluster, Vertex origin, Direction direction, float& t) {
+  int closest = -1;
+  for (int lane = 0; lane < SPHERE_CLUSTER_SIZE; lane++) {
+    float fx = origin.x - cluster.center_x[lane];
+    float fy = origin.y - cluster.center_y[lane];
+    float fz = origin.z - cluster.center_z[lane];
+    float b = -(fx * direction.x + fy * direction.y + fz * direction.z);
+    float lx = fx + b * direction.x;
+    float ly = fy + b * direction.y;
+    float lz = fz + b * direction.z;
+    float radius2 = cluster.radius[lane] * cluster.radius[lane];
+    float discriminant = radius2 - (lx * lx + ly * ly + lz * lz);
+    float c = (fx * fx + fy * fy + fz * fz) - radius2;
+    float q = b + std::copysign(sqrtf(discriminant), b);
+    float t0 = c / q;
+    float t1 = q;
+    float t_near = t0 < t1 ? t0 : t1;
+    float t_far = t0 > t1 ? t0 : t1;
+    float t_hit = t_near > 0.f ? t_near : t_far;
+    if (discriminant >= 0.f && t_hit > 0.f && t_hit < t) {
+      t = t_hit;
+      closest = lane;
+    }
+  }
+  return closest;
+}
+
+#ifdef SPHERE_SET_AVX2
+
+// Only compiled for AVX2, and only called after HasAvx2() said yes
+__attribute__((target("avx2")))
+int SphereSet::IntersectClusterAvx2(const SphereCluster& cluster, Vertex origin, Direction direction, float& t) {
+  __m256 cx = _mm256_loadu_ps(cluster.center_x);
+  __m256 cy = _mm256_loadu_ps(cluster.center_y);
+  __m256 cz = _mm256_loadu_ps(cluster.center_z);
+  __m256 r = _mm256_loadu_ps(cluster.radius);
+  __m256 dx = _mm256_set1_ps(direction.x);
+  __m256 dy = _mm256_set1_ps(direction.y);
+  __m256 dz = _mm256_set1_ps(direction.z);
+  __m256 sign_mask = _mm256_set1_ps(-0.f);
+  __m256 zero = _mm256_setzero_ps();
+
+  __m256 fx = _mm256_sub_ps(_mm256_set1_ps(origin.x), cx);
+  __m256 fy = _mm256_sub_ps(_mm256_set1_ps(origin.y), cy);
+  __m256 fz = _mm256_sub_ps(_mm256_set1_ps(origin.z), cz);
+  __m256 b = _mm256_xor_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(fx, dx), _mm256_mul_ps(fy, dy)),
+                                         _mm256_mul_ps(fz, dz)), sign_mask);
+  __m256 lx = _mm256_add_ps(fx, _mm256_mul_ps(b, dx));
+  __m256 ly = _mm256_add_ps(fy, _mm256_mul_ps(b, dy));
+  __m256 lz = _mm256_add_ps(fz, _mm256_mul_ps(b, dz));
+  __m256 radius2 = _mm256_mul_ps(r, r);
+  __m256 discriminant = _mm256_sub_ps(radius2, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, lx), _mm256_mul_ps(ly, ly)),
+                                                             _mm256_mul_ps(lz, lz)));
+  __m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(fx, fx), _mm256_mul_ps(fy, fy)),
+                                         _mm256_mul_ps(fz, fz)), radius2);
+  __m256 root = _mm256_or_ps(_mm256_sqrt_ps(discriminant), _mm256_and_ps(b, sign_mask));
+  __m256 q = _mm256_add_ps(b, root);
+  __m256 t0 = _mm256_div_ps(c, q);
+  __m256 t_near = _mm256_min_ps(t0, q);
+  __m256 t_far = _mm256_max_ps(t0, q);
+  __m256 t_hit = _mm256_blendv_ps(t_far, t_near, _mm256_cmp_ps(t_near, zero, _CMP_GT_OQ));
+
+  __m256 hit = _mm256_and_ps(_mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ),
+                             _mm256_and_ps(_mm256_cmp_ps(t_hit, zero, _CMP_GT_OQ),
+                                           _mm256_cmp_ps(t_hit, _mm256_set1_ps(t), _CMP_LT_OQ)));
+  if (_mm256_movemask_ps(hit) == 0) {
+    return -1;
+  }
+  // Closest lane: minimum over all lanes, then the first lane that has it
+  __m256 candidates = _mm256_blendv_ps(_mm256_set1_ps(FLT_MAX), t_hit, hit);
+  __m256 minimum = _mm256_min_ps(candidates, _mm256_permute2f128_ps(candidates, candidates, 1));
+  minimum = _mm256_min_ps(minimum, _mm256_shuffle_ps(minimum, minimum, _MM_SHUFFLE(1, 0, 3, 2)));
+  minimum = _mm256_min_ps(minimum, _mm256_shuffle_ps(minimum, minimum, _MM_SHUFFLE(2, 3, 0, 1)));
+  int lanes = _mm256_movemask_ps(_mm256_and_ps(hit, _mm256_cmp_ps(candidates, minimum, _CMP_EQ_OQ)));
+  t = _mm_cvtss_f32(_mm256_castps256_ps128(minimum));
+  return __builtin_ctz(lanes);
+}
+
+#else
+
+int SphereSet::IntersectClusterAvx2(const SphereCluster& cluster, Vertex origin, Direction direction, float& t) {
+  return IntersectCluster(cluster, origin, direction, t);
+}
+
+#endif
+
+int SphereSet::Intersect(Vertex origin, Direction direction, float& t) const {
+  int closest = -1;
+  bvh_.Traverse(origin, direction, t, [&](int cluster, float& t_max) {
+    int lane = use_avx2_ ? IntersectClusterAvx2(clusters_[cluster], origin, direction, t_max)
+                         : IntersectCluster(clusters_[cluster], origin, direction, t_max);
+    if (lane >= 0) {
+      closest = clusters_[cluster].sphere[lane];
+    }
+    return false;
+  });
+  return closest;
+}
+
+IntersectionPoint* SphereSet::RayIntersection(Ray& ray, Arena& arena) {
+  float t = FLT_MAX;
+  int sphere = Intersect(ray.get_origin(), ray.get_direction(), t);
+  if (sphere < 0) {
+    return nullptr;
+  }
+  Vertex intersection_point = ray.get_origin() + ray.get_direction() * t;
+  return arena.Create<IntersectionPoint>(intersection_point, intersection_point - centers_[sphere],
+                                         &materials_[sphere_materials_[sphere]], t);
+}
+
+Aabb SphereSet::GetBounds() {
+  return bvh_.get_bounds();
+}
+
+SphereSet* SphereSet::Clone(Arena& arena, const MeshCopies& /*meshes*/) const {
+  return arena.Create<SphereSet>(*this);
+}
+
+// Photons are aimed at the whole set if any of its materials makes caustics
+bool SphereSet::GetCausticBounds(Vertex& center, float& radius) {
+  bool has_caustic_material = false;
+  for (const Material& material : materials_) {
+    has_caustic_material = has_caustic_material || material.get_type() != MATERIAL_LAMBERTIAN;
+  }
+  if (!has_caustic_material || clusters_.empty()) {
+    return false;
+  }
+  Aabb bounds = bvh_.get_bounds();
+  center = bounds.Centroid();
+  radius = 0.5f * glm::length(bounds.max - bounds.min);
+  return true;
+}
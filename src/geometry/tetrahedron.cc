@@ -12,6 +12,7 @@ Tetrahedron::Tetrahedron(Triangle& t0,
   triangles_.push_back(t1);
   triangles_.push_back(t2);
   triangles_.push_back(t3);
+  BuildBvh();
 }
 
 Tetrahedron::Tetrahedron(float width, float height, Vertex position, Material material) {
@@ -38,4 +39,5 @@ Tetrahedron::Tetrahedron(float width, float height, Vertex position, Material ma
   triangles_.push_back(t1);
   triangles_.push_back(t2);
   triangles_.push_back(t3);
+  BuildBvh();
 }
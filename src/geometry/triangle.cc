@@ -1,6 +1,8 @@
 #include "triangle.h"
 #include "intersection_point.h"
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 
 Triangle::Triangle(Vertex v0, Vertex v1, Vertex v2) : v0_(v0), v1_(v1), v2_(v2) {
   material_ = PERFECT_MIRROR;
@@ -20,35 +22,96 @@ void Triangle::CalcNormal() {
   normal_ = glm::cross(v1_-v0_,v2_-v1_);
 }
 
-std::unique_ptr<IntersectionPoint> Triangle::RayIntersection(Ray& ray) {
-  Direction ps = ray.get_origin(); // eye_position
-  Direction D = ray.get_direction();
-  // Simple check if the triangle is facing the camera
-  // If non-negative it is facing away from the camera, i.e. not visible from camera
-    //if ( glm::dot(normal_,glm::normalize(D)) >= 0) {
-    //  return FLT_MAX;
-    //}
+RayShear::RayShear(Direction direction) {
+  // z is the largest axis of the direction, x and y are swapped when it
+  // points backwards so the winding of the triangles stays the same
+  kz = std::abs(direction.x) > std::abs(direction.y) ? 0 : 1;
+  if (std::abs(direction.z) > std::abs(direction[kz])) {
+    kz = 2;
+  }
+  kx = (kz + 1) % 3;
+  ky = (kx + 1) % 3;
+  if (direction[kz] < 0.f) {
+    std::swap(kx, ky);
+  }
+  sx = direction[kx] / direction[kz];
+  sy = direction[ky] / direction[kz];
+  sz = 1.f / direction[kz];
+}
 
-  // According to the Möller Trumbore intersection algorithm
-  Direction T = ps - v0_;
-  Direction E1 = v1_ - v0_;
-  Direction E2 = v2_ - v0_;
-  Direction P = glm::cross(D, E2);
+bool Triangle::Intersect(Vertex origin, Direction direction, float& t) const {
+  return Intersect(origin, RayShear(direction), t);
+}
 
-  float det = glm::dot(P, E1);
+// Watertight intersection of Woop, Benthin & Wald (2013). The vertices are
+// sheared into a space where the ray is the z axis, where the edge tests of
+// two triangles sharing an edge use the same numbers and cannot both miss
+bool Triangle::Intersect(Vertex origin, const RayShear& shear, float& t) const {
+  Direction a = v0_ - origin;
+  Direction b = v1_ - origin;
+  Direction c = v2_ - origin;
+  float ax = a[shear.kx] - shear.sx * a[shear.kz];
+  float ay = a[shear.ky] - shear.sy * a[shear.kz];
+  float bx = b[shear.kx] - shear.sx * b[shear.kz];
+  float by = b[shear.ky] - shear.sy * b[shear.kz];
+  float cx = c[shear.kx] - shear.sx * c[shear.kz];
+  float cy = c[shear.ky] - shear.sy * c[shear.kz];
 
-  Direction Q = glm::cross(T, E1);
-  float t = glm::dot(Q,E2) / det;
-  float u = glm::dot(P, T) / det;
-  float v = glm::dot(Q, D) / det;
+  // Scaled barycentric coordinates, exactly 0 on an edge in single
+  // precision is decided again in double
+  float u = cx * by - cy * bx;
+  float v = ax * cy - ay * cx;
+  float w = bx * ay - by * ax;
+  if (u == 0.f || v == 0.f || w == 0.f) {
+    u = (float)((double)cx * by - (double)cy * bx);
+    v = (float)((double)ax * cy - (double)ay * cx);
+    w = (float)((double)bx * ay - (double)by * ax);
+  }
+  if ((u < 0.f || v < 0.f || w < 0.f) && (u > 0.f || v > 0.f || w > 0.f)) {
+    return false;
+  }
+  float det = u + v + w;
+  if (det == 0.f) { // parallel to the ray or degenerate
+    return false;
+  }
+
+  // Distance times det, compared before dividing
+  float t_scaled = u * shear.sz * a[shear.kz] + v * shear.sz * b[shear.kz] +
+      w * shear.sz * c[shear.kz];
+  if (det > 0.f ? (t_scaled <= 0.f || t_scaled >= t * det)
+                : (t_scaled >= 0.f || t_scaled <= t * det)) {
+    return false;
+  }
+  t = t_scaled / det;
+  return true;
+}
+
+IntersectionPoint* Triangle::RayIntersection(Ray& ray, Arena& arena) {
+  float t = FLT_MAX;
+  if (!Intersect(ray.get_origin(), ray.get_direction(), t)) {
+    return nullptr;
+  }
+  return arena.Create<IntersectionPoint>(ray.get_origin() + t * ray.get_direction(), normal_, &material_, t);
+}
+
+Aabb Triangle::GetBounds() {
+  Aabb bounds(v0_, v0_);
+  bounds.Extend(v1_);
+  bounds.Extend(v2_);
+  return bounds;
+}
+
+Triangle* Triangle::Clone(Arena& arena, const MeshCopies& /*meshes*/) const {
+  return arena.Create<Triangle>(*this);
+}
 
-  if(u >= 0 && v >= 0 && u+v <= 1 && t > 0.f) { //if collision with a triangle closer to cam than before
-    Vertex intersection_vertex = (1-u-v)*v0_ + u*v1_ + v*v2_;
-    // std::cout << "Successful update of pixel!" << std::endl; //TODO: remove when EVERYTHING is implemented
-    return std::make_unique<IntersectionPoint>(intersection_vertex, normal_, material_, t);
+bool Triangle::GetCausticBounds(Vertex& center, float& radius) {
+  if (material_.get_type() == MATERIAL_LAMBERTIAN) {
+    return false;
   }
-  // std::cout << "Unsuccessful update of pixel! :'(" << std::endl; //TODO: remove when EVERYTHING is implemented
-  return nullptr;
+  center = (v0_ + v1_ + v2_) / 3.f;
+  radius = fmax(glm::length(v0_ - center), fmax(glm::length(v1_ - center), glm::length(v2_ - center)));
+  return true;
 }
 
 void Triangle::Print() const {
@@ -0,0 +1,82 @@
+#include "grid.h"
+#include <cmath>
+
+const int GRID_MAX_RESOLUTION = 1024;
+
+Grid::Grid() : cell_size_(1.f, 1.f, 1.f) {
+  resolution_[0] = resolution_[1] = resolution_[2] = 0;
+}
+
+void Grid::GetCellRange(const Aabb& box, int first[3], int last[3]) const {
+  for (int axis = 0; axis < 3; axis++) {
+    first[axis] = (int)((box.min[axis] - bounds_.min[axis]) / cell_size_[axis]);
+    last[axis] = (int)((box.max[axis] - bounds_.min[axis]) / cell_size_[axis]);
+    first[axis] = std::min(std::max(first[axis], 0), resolution_[axis] - 1);
+    last[axis] = std::min(std::max(last[axis], 0), resolution_[axis] - 1);
+  }
+}
+
+// Cleary and Wyvill: pick the cell size so the grid has about
+// cells_per_primitive times as many cells as there are primitives
+void Grid::Build(const std::vector<Aabb>& primitive_bounds, float cells_per_primitive /* = 2.f */) {
+  bounds_ = Aabb();
+  cell_starts_.clear();
+  indices_.clear();
+  resolution_[0] = resolution_[1] = resolution_[2] = 0;
+  for (const Aabb& box : primitive_bounds) {
+    bounds_.Extend(box);
+  }
+  if (bounds_.IsEmpty()) {
+    return;
+  }
+  // Flat scenes still get a volume
+  Direction extent = bounds_.max - bounds_.min;
+  float max_extent = std::max(extent.x, std::max(extent.y, extent.z));
+  extent = glm::max(extent, Direction(1e-3f * max_extent + FLT_MIN));
+  bounds_.max = bounds_.min + extent;
+  float cells_per_unit = cbrtf(cells_per_primitive * primitive_bounds.size() / (extent.x * extent.y * extent.z));
+  for (int axis = 0; axis < 3; axis++) {
+    resolution_[axis] = std::min(std::max((int)(extent[axis] * cells_per_unit), 1), GRID_MAX_RESOLUTION);
+    cell_size_[axis] = extent[axis] / resolution_[axis];
+  }
+
+  // Count, prefix sum, then fill, so every cell's list is contiguous
+  cell_starts_.assign(get_cell_count() + 1, 0);
+  int first[3], last[3];
+  for (const Aabb& box : primitive_bounds) {
+    GetCellRange(box, first, last);
+    for (int z = first[2]; z <= last[2]; z++) {
+      for (int y = first[1]; y <= last[1]; y++) {
+        for (int x = first[0]; x <= last[0]; x++) {
+          cell_starts_[(z * resolution_[1] + y) * resolution_[0] + x + 1]++;
+        }
+      }
+    }
+  }
+  for (int c = 0; c < get_cell_count(); c++) {
+    cell_starts_[c + 1] += cell_starts_[c];
+  }
+  indices_.resize(cell_starts_.back());
+  std::vector<int> fill(cell_starts_.begin(), cell_starts_.end() - 1);
+  for (int primitive = 0; primitive < (int)primitive_bounds.size(); primitive++) {
+    GetCellRange(primitive_bounds[primitive], first, last);
+    for (int z = first[2]; z <= last[2]; z++) {
+      for (int y = first[1]; y <= last[1]; y++) {
+        for (int x = first[0]; x <= last[0]; x++) {
+          indices_[fill[(z * resolution_[1] + y) * resolution_[0] + x]++] = primitive;
+        }
+      }
+    }
+  }
+}
+
+float Grid::GetOccupancy() const {
+  if (get_cell_count() == 0) {
+    return 0.f;
+  }
+  int occupied = 0;
+  for (int c = 0; c < get_cell_count(); c++) {
+    occupied += cell_starts_[c + 1] > cell_starts_[c];
+  }
+  return (float)occupied / get_cell_count();
+}
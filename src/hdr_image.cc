@@ -0,0 +1,167 @@
+#include "hdr_image.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+
+const int EXR_TILE_SIZE = 32;
+const int EXR_PIXEL_TYPE_UINT = 0;
+const int EXR_PIXEL_TYPE_FLOAT = 2;
+
+// EXR is always little-endian, so serialize byte by byte instead of relying
+// on the host byte order
+static void PutInt32(std::string& buffer, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    buffer.push_back((char)((value >> (8 * i)) & 0xff));
+  }
+}
+
+static void PutInt64(std::string& buffer, uint64_t value) {
+  for (int i = 0; i < 8; i++) {
+    buffer.push_back((char)((value >> (8 * i)) & 0xff));
+  }
+}
+
+static void PutFloat(std::string& buffer, float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  PutInt32(buffer, bits);
+}
+
+static void PutAttribute(std::string& buffer, const char* name, const char* type,
+                         const std::string& value) {
+  buffer.append(name, strlen(name) + 1);
+  buffer.append(type, strlen(type) + 1);
+  PutInt32(buffer, (uint32_t)value.size());
+  buffer += value;
+}
+
+static bool IsLittleEndian() {
+  uint16_t one = 1;
+  unsigned char first_byte;
+  memcpy(&first_byte, &one, 1);
+  return first_byte == 1;
+}
+
+bool HdrImage::SavePfm(const char* img_name, Framebuffer& framebuffer) {
+  FILE* fp = fopen(img_name, "wb");
+  if (!fp) {
+    return false;
+  }
+  int width = framebuffer.size();
+  int height = width > 0 ? framebuffer[0].size() : 0;
+  // A negative scale marks little-endian data
+  (void)fprintf(fp, "PF\n%d %d\n%s\n", width, height, IsLittleEndian() ? "-1.0" : "1.0");
+
+  // PFM scanlines go from the bottom to the top of the image
+  std::vector<float> scanline(3 * width);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      glm::vec3 color = framebuffer[width - 1 - x][y].get_color();
+      scanline[3 * x + 0] = color.x;
+      scanline[3 * x + 1] = color.y;
+      scanline[3 * x + 2] = color.z;
+    }
+    (void)fwrite(scanline.data(), sizeof(float), scanline.size(), fp);
+  }
+  return fclose(fp) == 0;
+}
+
+bool HdrImage::SaveTiledExr(const char* img_name, Framebuffer& framebuffer) {
+  int width = framebuffer.size();
+  int height = width > 0 ? framebuffer[0].size() : 0;
+  if (width == 0 || height == 0) {
+    return false;
+  }
+  FILE* fp = fopen(img_name, "wb");
+  if (!fp) {
+    return false;
+  }
+
+  // Channels have to be sorted by name, and each channel entry is its name
+  // followed by pixel type, pLinear + 3 reserved bytes and x/y sampling
+  const char* channel_names[4] = { "B", "G", "R", "samples" };
+  const int channel_types[4] = { EXR_PIXEL_TYPE_FLOAT, EXR_PIXEL_TYPE_FLOAT,
+                                 EXR_PIXEL_TYPE_FLOAT, EXR_PIXEL_TYPE_UINT };
+  std::string channels;
+  for (int c = 0; c < 4; c++) {
+    channels.append(channel_names[c], strlen(channel_names[c]) + 1);
+    PutInt32(channels, channel_types[c]);
+    PutInt32(channels, 0);
+    PutInt32(channels, 1);
+    PutInt32(channels, 1);
+  }
+  channels.push_back('\0');
+
+  std::string window;
+  PutInt32(window, 0);
+  PutInt32(window, 0);
+  PutInt32(window, width - 1);
+  PutInt32(window, height - 1);
+
+  std::string one_float, two_floats, tiles;
+  PutFloat(one_float, 1.f);
+  PutFloat(two_floats, 0.f);
+  PutFloat(two_floats, 0.f);
+  PutInt32(tiles, EXR_TILE_SIZE);
+  PutInt32(tiles, EXR_TILE_SIZE);
+  tiles.push_back('\0'); // ONE_LEVEL, ROUND_DOWN
+
+  std::string header;
+  PutInt32(header, 20000630); // magic number
+  PutInt32(header, 2 | 0x200); // version 2, single part tiled
+  PutAttribute(header, "channels", "chlist", channels);
+  PutAttribute(header, "compression", "compression", std::string(1, '\0'));
+  PutAttribute(header, "dataWindow", "box2i", window);
+  PutAttribute(header, "displayWindow", "box2i", window);
+  PutAttribute(header, "lineOrder", "lineOrder", std::string(1, '\0'));
+  PutAttribute(header, "pixelAspectRatio", "float", one_float);
+  PutAttribute(header, "screenWindowCenter", "v2f", two_floats);
+  PutAttribute(header, "screenWindowWidth", "float", one_float);
+  PutAttribute(header, "tiles", "tiledesc", tiles);
+  header.push_back('\0');
+
+  // Uncompressed tiles have a known size, so the offset table can be written
+  // up front and the tiles streamed straight from the framebuffer afterwards
+  int tiles_x = (width + EXR_TILE_SIZE - 1) / EXR_TILE_SIZE;
+  int tiles_y = (height + EXR_TILE_SIZE - 1) / EXR_TILE_SIZE;
+  uint64_t offset = header.size() + 8 * (uint64_t)tiles_x * tiles_y;
+  for (int ty = 0; ty < tiles_y; ty++) {
+    for (int tx = 0; tx < tiles_x; tx++) {
+      PutInt64(header, offset);
+      int tile_width = std::min(EXR_TILE_SIZE, width - tx * EXR_TILE_SIZE);
+      int tile_height = std::min(EXR_TILE_SIZE, height - ty * EXR_TILE_SIZE);
+      offset += 20 + 16 * (uint64_t)tile_width * tile_height;
+    }
+  }
+  (void)fwrite(header.data(), 1, header.size(), fp);
+
+  std::string tile;
+  for (int ty = 0; ty < tiles_y; ty++) {
+    for (int tx = 0; tx < tiles_x; tx++) {
+      int tile_width = std::min(EXR_TILE_SIZE, width - tx * EXR_TILE_SIZE);
+      int tile_height = std::min(EXR_TILE_SIZE, height - ty * EXR_TILE_SIZE);
+      tile.clear();
+      PutInt32(tile, tx);
+      PutInt32(tile, ty);
+      PutInt32(tile, 0); // level x
+      PutInt32(tile, 0); // level y
+      PutInt32(tile, 16 * tile_width * tile_height);
+      // EXR rows go from the top to the bottom of the image
+      for (int row = ty * EXR_TILE_SIZE; row < ty * EXR_TILE_SIZE + tile_height; row++) {
+        int y = height - 1 - row;
+        for (int c = 2; c >= 0; c--) {
+          for (int col = tx * EXR_TILE_SIZE; col < tx * EXR_TILE_SIZE + tile_width; col++) {
+            PutFloat(tile, framebuffer[width - 1 - col][y].get_color()[c]);
+          }
+        }
+        for (int col = tx * EXR_TILE_SIZE; col < tx * EXR_TILE_SIZE + tile_width; col++) {
+          PutInt32(tile, framebuffer[width - 1 - col][y].get_samples());
+        }
+      }
+      (void)fwrite(tile.data(), 1, tile.size(), fp);
+    }
+  }
+  return fclose(fp) == 0;
+}
@@ -2,6 +2,6 @@
 
 IntersectionPoint::IntersectionPoint(Vertex position,
                                      Direction normal,
-                                     Material material,
+                                     const Material* material,
                                      float z)
     : position_(position), normal_(normal), material_(material), z_(z) {}
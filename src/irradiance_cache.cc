@@ -0,0 +1,104 @@
+#include "irradiance_cache.h"
+#include <algorithm>
+#include <cmath>
+
+const int MAX_OCTREE_DEPTH = 16;
+
+IrradianceCache::IrradianceCache(Vertex min, Vertex max, float error_threshold)
+    : error_threshold_(error_threshold) {
+  Direction extent = max - min;
+  float half_size = 0.5f * std::max(extent.x, std::max(extent.y, extent.z));
+  AddNode((min + max) * 0.5f, half_size);
+}
+
+int IrradianceCache::AddNode(Vertex center, float half_size) {
+  Node node;
+  node.center = center;
+  node.half_size = half_size;
+  std::fill(node.children, node.children + 8, -1);
+  nodes_.push_back(node);
+  return nodes_.size() - 1;
+}
+
+void IrradianceCache::Add(const IrradianceRecord& record) {
+  records_.push_back(record);
+  // A record can only be used where |x - x_i| / R_i < a
+  Insert(0, records_.size() - 1, error_threshold_ * record.radius, 0);
+}
+
+// Stores the record in every node of the first level that is not larger
+// than the record's area of influence, so a lookup only has to check the
+// nodes on the path from the root to the point
+void IrradianceCache::Insert(int node, int record, float record_half_size, int depth) {
+  if (nodes_[node].half_size <= record_half_size || depth == MAX_OCTREE_DEPTH) {
+    nodes_[node].records.push_back(record);
+    return;
+  }
+  Vertex position = records_[record].position;
+  for (int child = 0; child < 8; child++) {
+    float child_half_size = 0.5f * nodes_[node].half_size;
+    Vertex child_center = nodes_[node].center + Direction(child & 1 ? child_half_size : -child_half_size,
+                                                          child & 2 ? child_half_size : -child_half_size,
+                                                          child & 4 ? child_half_size : -child_half_size);
+    bool overlaps = true;
+    for (int axis = 0; axis < 3; axis++) {
+      overlaps = overlaps &&
+          std::abs(position[axis] - child_center[axis]) <= child_half_size + record_half_size;
+    }
+    if (!overlaps) {
+      continue;
+    }
+    if (nodes_[node].children[child] < 0) {
+      int child_node = AddNode(child_center, child_half_size); // may move nodes_
+      nodes_[node].children[child] = child_node;
+    }
+    Insert(nodes_[node].children[child], record, record_half_size, depth + 1);
+  }
+}
+
+bool IrradianceCache::Lookup(Vertex position, Direction normal, ColorDbl& irradiance) const {
+  ColorDbl weighted_sum = COLOR_BLACK;
+  float weight_sum = 0.f;
+  int node = 0;
+  for (int axis = 0; axis < 3; axis++) {
+    if (std::abs(position[axis] - nodes_[0].center[axis]) > nodes_[0].half_size) {
+      return false;
+    }
+  }
+  while (node >= 0) {
+    const Node& current = nodes_[node];
+    for (int idx : current.records) {
+      const IrradianceRecord& record = records_[idx];
+      Direction offset = position - record.position;
+      // Skip records in front of the point, they see different geometry
+      if (glm::dot(offset, record.normal + normal) * 0.5f < -0.05f * record.radius) {
+        continue;
+      }
+      float n_dot_n = std::min(1.f, glm::dot(normal, record.normal));
+      float error = glm::length(offset) / record.radius + sqrtf(std::max(0.f, 1.f - n_dot_n));
+      if (error >= error_threshold_) {
+        continue;
+      }
+      float weight = error > 0.f ? 1.f / error : 1e6f;
+      // First order extrapolation with the rotational and translational
+      // gradients
+      Direction rotation = glm::cross(record.normal, normal);
+      ColorDbl extrapolated = record.irradiance;
+      for (int c = 0; c < 3; c++) {
+        extrapolated[c] += glm::dot(rotation, record.rotational_gradient[c]) +
+            glm::dot(offset, record.translational_gradient[c]);
+      }
+      weighted_sum += weight * glm::max(extrapolated, COLOR_BLACK);
+      weight_sum += weight;
+    }
+    int child = (position.x > current.center.x ? 1 : 0) |
+                (position.y > current.center.y ? 2 : 0) |
+                (position.z > current.center.z ? 4 : 0);
+    node = current.children[child];
+  }
+  if (weight_sum <= 0.f) {
+    return false;
+  }
+  irradiance = weighted_sum / weight_sum;
+  return true;
+}
@@ -4,43 +4,317 @@
 #include "camera.h"
 #include "scene.h"
 #include "material.h"
+#include "benchmark.h"
+#include "render_server.h"
 #ifdef _OPENMP
   #include <omp.h>
 #endif
+#ifdef __unix__
+  #include <poll.h>
+  #include <sys/wait.h>
+  #include <unistd.h>
+#endif
 #include <ctime>
+#include <chrono>
+#include <sstream>
 #include <string>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
 
-int main() {
-  std::cout << "GI-Ray to the rescue" << std::endl;
-  std::cout << "\nHow many samples/pixel do you want? ";
-  int spp;
-  std::cin >> spp;
+struct Options {
+  int spp = 0;
+  std::string checkpoint_path;
+  double checkpoint_interval = 60.0;
+  std::string resume_path;
+  unsigned int seed = 0;
+  bool stereo = false;
+  bool irradiance_cache = false;
+  int caustic_photons = 0;
+  Integrator integrator = INTEGRATOR_RAYTRACE;
+  SceneAccelerator accelerator = ACCELERATOR_AUTO;
+  bool benchmark = false;
+  int frames = 0;
+  bool numa = false;
+  bool cost_map = false;
+  bool estimate = false;
+
+  // Distributed rendering
+  int worker_index = -1;
+  int worker_count = 1;
+  bool partition_tiles = false;
+  std::string output_path;
+  int local_workers = 0;
+  std::string merge_name;
+  std::vector<std::string> merge_paths;
+
+  // Render server
+  std::string serve_path;
+  std::string submit_path;
+  std::string submit_command;
+
+  // Preview
+  bool preview = false;
+  int preview_scale = 4;
+  int preview_spp = 1;
+};
+
+// Samples/pixel of the pilot pass that --estimate times
+const int ESTIMATE_PILOT_SPP = 2;
+
+// A preview refines up to this many samples/pixel while the camera stands still
+const int PREVIEW_MAX_SPP = 64;
+
+static void PrintUsage() {
+  std::cout << "Usage: GI-Ray [options]\n"
+            << "  Without options GI-Ray asks for samples/pixel interactively.\n"
+            << "  --spp N                    render N samples/pixel and exit\n"
+            << "  --checkpoint FILE          periodically save the render to FILE\n"
+            << "  --checkpoint-interval S    seconds between checkpoints (default 60)\n"
+            << "  --resume FILE              continue the render saved in FILE\n"
+            << "  --seed S                   seed of the random sequences (default 0)\n"
+            << "  --stereo                   render both eye positions in one pass\n"
+            << "  --irradiance-cache         interpolate indirect diffuse light from a cache\n"
+            << "  --caustic-photons N        trace N photons for caustics from mirrors and glass\n"
+            << "  --integrator raytrace|bdpt camera rays only (default), or bidirectional path tracing\n"
+            << "  --accelerator auto|bvh|grid top level structure over the objects (default: picked per scene)\n"
+            << "  --frames N                 render N frames of the animated scene (with --spp)\n"
+            << "  --numa                     pin threads and keep a scene copy on every NUMA node\n"
+            << "  --cost-map                 also write the time and rays of every tile as heatmap and csv\n"
+            << "  --estimate                 predict the render time of --spp N from a short pilot pass\n"
+            << "  --benchmark                measure acceleration structures instead of rendering\n"
+            << "\nPreview:\n"
+            << "  --preview                  render a small image after every camera command read\n"
+            << "                             from stdin (\"eye X Y Z\", \"move DX DY DZ\", \"quit\")\n"
+            << "                             and refine it while no command comes\n"
+            << "  --preview-scale N          1/N of the full resolution (default 4)\n"
+            << "  --preview-spp N            samples/pixel after every move, 1-4 (default 1)\n"
+            << "\nDistributed rendering:\n"
+            << "  --worker K/N               render part K (0-based) of N and save a partial buffer\n"
+            << "  --partition samples|tiles  split the work by sample range (default) or by tiles\n"
+            << "  --output FILE              partial buffer of a worker\n"
+            << "                             (default results/part_K_of_N.ckpt)\n"
+            << "  --local-workers N          fork N local worker processes and merge their output\n"
+            << "  --merge NAME FILE...       merge partial buffers into results/*_NAME images\n"
+            << "\nRender server:\n"
+            << "  --serve SOCKET             keep the scene loaded and render jobs sent to SOCKET\n"
+            << "  --submit SOCKET COMMAND... send a command to a server and print its replies, e.g.\n"
+            << "                             --submit gi.sock render spp=4 width=320 height=240 output=preview" << std::endl;
+}
 
-  while (spp > 0) {
-    std::clock_t start = std::clock();
+static bool ParseOptions(int argc, char* argv[], Options& options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--spp" && has_value) {
+      options.spp = std::atoi(argv[++i]);
+    } else if (arg == "--checkpoint" && has_value) {
+      options.checkpoint_path = argv[++i];
+    } else if (arg == "--checkpoint-interval" && has_value) {
+      options.checkpoint_interval = std::atof(argv[++i]);
+    } else if (arg == "--resume" && has_value) {
+      options.resume_path = argv[++i];
+    } else if (arg == "--stereo") {
+      options.stereo = true;
+    } else if (arg == "--irradiance-cache") {
+      options.irradiance_cache = true;
+    } else if (arg == "--caustic-photons" && has_value) {
+      options.caustic_photons = std::atoi(argv[++i]);
+    } else if (arg == "--integrator" && has_value) {
+      std::string integrator = argv[++i];
+      if (integrator != "raytrace" && integrator != "bdpt") {
+        return false;
+      }
+      options.integrator = integrator == "bdpt" ? INTEGRATOR_BIDIRECTIONAL : INTEGRATOR_RAYTRACE;
+    } else if (arg == "--accelerator" && has_value) {
+      std::string accelerator = argv[++i];
+      if (accelerator == "auto") {
+        options.accelerator = ACCELERATOR_AUTO;
+      } else if (accelerator == "bvh") {
+        options.accelerator = ACCELERATOR_BVH;
+      } else if (accelerator == "grid") {
+        options.accelerator = ACCELERATOR_GRID;
+      } else {
+        return false;
+      }
+    } else if (arg == "--frames" && has_value) {
+      options.frames = std::atoi(argv[++i]);
+    } else if (arg == "--numa") {
+      options.numa = true;
+    } else if (arg == "--cost-map") {
+      options.cost_map = true;
+    } else if (arg == "--estimate") {
+      options.estimate = true;
+    } else if (arg == "--benchmark") {
+      options.benchmark = true;
+    } else if (arg == "--preview") {
+      options.preview = true;
+    } else if (arg == "--preview-scale" && has_value) {
+      options.preview_scale = std::atoi(argv[++i]);
+      if (options.preview_scale < 1 || options.preview_scale > WIDTH) {
+        return false;
+      }
+    } else if (arg == "--preview-spp" && has_value) {
+      options.preview_spp = std::atoi(argv[++i]);
+      if (options.preview_spp < 1 || options.preview_spp > 4) {
+        return false;
+      }
+    } else if (arg == "--seed" && has_value) {
+      options.seed = (unsigned int)std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--worker" && has_value) {
+      if (sscanf(argv[++i], "%d/%d", &options.worker_index, &options.worker_count) != 2 ||
+          options.worker_count < 1 || options.worker_index < 0 ||
+          options.worker_index >= options.worker_count) {
+        return false;
+      }
+    } else if (arg == "--partition" && has_value) {
+      std::string partition = argv[++i];
+      if (partition != "samples" && partition != "tiles") {
+        return false;
+      }
+      options.partition_tiles = partition == "tiles";
+    } else if (arg == "--output" && has_value) {
+      options.output_path = argv[++i];
+    } else if (arg == "--local-workers" && has_value) {
+      options.local_workers = std::atoi(argv[++i]);
+    } else if (arg == "--serve" && has_value) {
+      options.serve_path = argv[++i];
+    } else if (arg == "--submit" && i + 2 < argc) {
+      options.submit_path = argv[++i];
+      options.submit_command = argv[++i];
+      while (i + 1 < argc) {
+        options.submit_command += std::string(" ") + argv[++i];
+      }
+    } else if (arg == "--merge" && has_value) {
+      options.merge_name = argv[++i];
+      while (i + 1 < argc) {
+        options.merge_paths.push_back(argv[++i]);
+      }
+    } else {
+      return false;
+    }
+  }
+  // Partial buffers only hold the framebuffer of one eye
+  if (options.stereo && (options.worker_index >= 0 || options.local_workers > 0)) {
+    std::cerr << "\t--stereo can not be combined with --worker or --local-workers" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static std::string PartialRenderPath(int worker_index, int worker_count) {
+  return "results/part_" + std::to_string(worker_index) + "_of_" +
+      std::to_string(worker_count) + ".ckpt";
+}
+
+// Renders the scene and writes all images, returns false if nothing could be
+// rendered
+static bool RenderImage(const Options& options) {
+  std::clock_t start = std::clock();
 
 #ifdef _OPENMP
-    double start_time = omp_get_wtime();
+  double start_time = omp_get_wtime();
 #else
-    std::cout << "\nMultithreading not supported" << std::endl;
+  std::cout << "\nMultithreading not supported" << std::endl;
 #endif
 
-    std::cout << "\tCreating scene and camera..." << std::endl;
-    Scene scene = Scene();
-    Camera cam = Camera(Vertex(-2, 0, 0), Vertex(-1, 0, 0), Direction(1, 0, 0), Direction(0, 0, 1));
-    cam.ClearColorBuffer(glm::vec3(155, 45, 90));
+  std::cout << "\tCreating scene and camera..." << std::endl;
+  Scene scene = Scene(options.accelerator);
+  Camera cam = Camera(Vertex(-2, 0, 0), Vertex(-1, 0, 0), Direction(1, 0, 0), Direction(0, 0, 1));
+  cam.ClearColorBuffer(glm::vec3(155, 45, 90));
+
+  //cam.Render(scene);
+  //cam.CreateImage("max_intensity_ep1",true);
+  //cam.CreateImage("sqrt_intensity_ep1",false);
 
-    //cam.Render(scene);
-    //cam.CreateImage("max_intensity_ep1",true);
-    //cam.CreateImage("sqrt_intensity_ep1",false);
+  cam.ChangeEyePos();
+  cam.set_seed(options.seed);
+  cam.EnableIrradianceCache(options.irradiance_cache);
+  cam.EnableCausticPhotons(options.caustic_photons);
+  cam.EnableNumaPinning(options.numa);
+  cam.set_integrator(options.integrator);
 
-    cam.ChangeEyePos();
+  int spp = options.spp;
+  std::string checkpoint_path = options.checkpoint_path;
+  if (options.worker_index >= 0) {
+    // A worker saves its partial buffer through the checkpoint mechanism,
+    // which also makes every worker resumable on its own
+    cam.set_partial_render(options.spp);
+    if (options.partition_tiles) {
+      cam.set_tile_partition(options.worker_index, options.worker_count);
+    } else {
+      int first_sample = (long long)options.spp * options.worker_index / options.worker_count;
+      int last_sample = (long long)options.spp * (options.worker_index + 1) / options.worker_count;
+      cam.set_first_sample(first_sample);
+      spp = last_sample - first_sample;
+    }
+    checkpoint_path = options.output_path.empty() ?
+        PartialRenderPath(options.worker_index, options.worker_count) : options.output_path;
+  }
+  if (!options.resume_path.empty()) {
+    spp = cam.ResumeFromCheckpoint(options.resume_path);
+    if (spp < 0) {
+      std::cerr << "\tCould not resume from " << options.resume_path << std::endl;
+      return false;
+    }
+    if (cam.IsPartialRender() && options.stereo) {
+      std::cerr << "\t" << options.resume_path << " is a partial render, which can not be resumed in stereo" << std::endl;
+      return false;
+    }
+    std::cout << "\tResuming after " << cam.get_samples_rendered() << " samples/pixel..." << std::endl;
+    if (checkpoint_path.empty()) {
+      checkpoint_path = options.resume_path;
+    }
+  }
+  if (options.estimate) {
+    if (spp <= 0) {
+      std::cout << "\tNothing left to render, no estimate needed" << std::endl;
+      return true;
+    }
+    int pilot_spp = std::min(spp, ESTIMATE_PILOT_SPP);
+    std::cout << "\tRendering a pilot pass with " << pilot_spp << " samples/pixel..." << std::endl;
+    double seconds = cam.EstimateRenderTime(scene, spp, pilot_spp, options.stereo);
+    std::cout << "\n\tEstimated render time for " << spp << " samples/pixel: " << seconds << " s" << std::endl;
+    std::string path = cam.CreateCostMap("cost_pilot_" + std::to_string(pilot_spp) + "spp");
+    if (!path.empty()) {
+      std::cout << "\tTile costs of the pilot pass written to " << path << std::endl;
+    }
+    return true;
+  }
+  if (!checkpoint_path.empty()) {
+    cam.EnableCheckpoints(checkpoint_path, options.checkpoint_interval);
+  }
 
+  if (options.stereo) {
+    std::cout << "\tRendering both eyes with " << spp << " samples/pixel..." << std::endl;
+    cam.RenderStereo(scene, spp);
+  } else {
     std::cout << "\tRendering scene with " << spp << " samples/pixel..." << std::endl;
     cam.Render(scene, spp);
-    std::cout << "\n\tRendering Finished" << std::endl;
+  }
+  std::cout << "\n\tRendering Finished" << std::endl;
+
+  if (options.cost_map) {
+    std::string path = cam.CreateCostMap("cost_" + std::to_string(cam.get_samples_rendered()) + "spp");
+    if (!path.empty()) {
+      std::cout << "\tTile costs written to " << path << std::endl;
+    }
+  }
 
-    std::string suffix = std::to_string(spp) + "spp";
+  if (cam.IsPartialRender()) {
+    std::cout << "\tPartial render saved to " << checkpoint_path << std::endl;
+    return true;
+  }
+
+  for (int eye = 0; eye < (options.stereo ? 2 : 1); eye++) {
+    std::string suffix = std::to_string(cam.get_samples_rendered()) + "spp";
+    if (options.stereo) {
+      suffix = "eye" + std::to_string(1 - eye) + "_" + suffix;
+      if (eye == 1) {
+        cam.ChangeEyePos();
+      }
+    }
 
     std::cout << "\tCreating max intensity image..." << std::endl;
     cam.CreateImage("mi_" + suffix, true);
@@ -48,15 +322,309 @@ int main() {
     std::cout << "\tCreating gamma corrected image..." << std::endl;
     cam.CreateImage("si_" + suffix, false);
 
-    double cpu_duration = (std::clock() - start) / (double)CLOCKS_PER_SEC;
-    std::cout << "\nExecution time across all cores: " << cpu_duration;
+    std::cout << "\tCreating linear HDR images..." << std::endl;
+    cam.CreateHdrImage("hdr_" + suffix);
+  }
+
+  double cpu_duration = (std::clock() - start) / (double)CLOCKS_PER_SEC;
+  std::cout << "\nExecution time across all cores: " << cpu_duration;
 #ifdef _OPENMP
-    double duration = omp_get_wtime() - start_time;
-    std::cout << "\nReal time taken: " << duration << std::endl;
+  double duration = omp_get_wtime() - start_time;
+  std::cout << "\nReal time taken: " << duration << std::endl;
 #endif
+  return true;
+}
+
+// Renders the animation from time 0 up to (but not including) 1, so looping
+// animations can be played back without a repeated frame. The scene is only
+// built once, between frames the BVH is refitted
+static bool RenderAnimation(const Options& options) {
+  std::cout << "\tCreating scene and camera..." << std::endl;
+  Scene scene = Scene(options.accelerator);
+  Camera cam = Camera(Vertex(-2, 0, 0), Vertex(-1, 0, 0), Direction(1, 0, 0), Direction(0, 0, 1));
+  cam.ChangeEyePos();
+  cam.set_seed(options.seed);
+  cam.EnableIrradianceCache(options.irradiance_cache);
+  cam.EnableCausticPhotons(options.caustic_photons);
+  cam.EnableNumaPinning(options.numa);
+  cam.set_integrator(options.integrator);
+
+  int rebuilds = 0;
+  for (int frame = 0; frame < options.frames; frame++) {
+    float time = (float)frame / options.frames;
+    if (frame > 0 && scene.SetTime(time)) {
+      rebuilds++;
+    }
+    std::cout << "\n\tRendering frame " << frame + 1 << "/" << options.frames << " with "
+              << options.spp << " samples/pixel..." << std::endl;
+    cam.ClearColorBuffer(glm::vec3(155, 45, 90));
+    cam.Render(scene, options.spp);
+
+    char frame_name[16];
+    snprintf(frame_name, sizeof(frame_name), "frame%04d", frame);
+    std::string suffix = std::to_string(options.spp) + "spp_" + frame_name;
+    cam.CreateImage("si_" + suffix, false);
+    cam.CreateHdrImage("hdr_" + suffix);
+  }
+  if (scene.UsesGrid()) {
+    std::cout << "\n\tAnimation finished, the grid was rebuilt for every frame" << std::endl;
+  } else {
+    std::cout << "\n\tAnimation finished, the BVH was rebuilt for " << rebuilds << " of "
+              << std::max(0, options.frames - 1) << " frames and refitted for the rest" << std::endl;
+  }
+  return true;
+}
+
+// Reads the next line from stdin, waiting for one only if wait is set.
+// Returns false if there is none yet, closed tells if there will be none
+static bool ReadCommand(std::string& buffer, std::string& line, bool wait, bool& closed) {
+  size_t newline;
+  while ((newline = buffer.find('\n')) == std::string::npos) {
+#ifdef __unix__
+    pollfd input = { STDIN_FILENO, POLLIN, 0 };
+    if (poll(&input, 1, wait ? -1 : 0) <= 0) {
+      return false;
+    }
+    char chunk[512];
+    ssize_t n = read(STDIN_FILENO, chunk, sizeof(chunk));
+    if (n <= 0) {
+      closed = true;
+      return false;
+    }
+    buffer.append(chunk, n);
+#else
+    // Without poll() the preview only refines up to the first move
+    if (!wait || !std::getline(std::cin, line)) {
+      closed = wait;
+      return false;
+    }
+    return true;
+#endif
+  }
+  line = buffer.substr(0, newline);
+  buffer.erase(0, newline + 1);
+  return true;
+}
+
+// Renders a low resolution image for every camera command and reprojects
+// what the previous one accumulated, so framing a shot does not need full
+// renders. While no command comes the image keeps getting more samples.
+// Every step overwrites results/preview_*.ppm
+static bool RunPreview(const Options& options) {
+  std::cout << "\tCreating scene and camera..." << std::endl;
+  Scene scene = Scene(options.accelerator);
+  Vertex eye = Vertex(-1, 0, 0);
+  Camera cam = Camera(eye, eye, Direction(1, 0, 0), Direction(0, 0, 1),
+                      std::max(1, WIDTH / options.preview_scale), std::max(1, HEIGHT / options.preview_scale));
+  cam.ClearColorBuffer(COLOR_BLACK);
+  cam.set_seed(options.seed);
+  cam.EnableNumaPinning(options.numa);
+  cam.set_integrator(options.integrator);
+  cam.set_progress_callback([](double) {});
+  std::cout << "\tPreview at " << cam.get_width() << "x" << cam.get_height()
+            << ", commands: eye X Y Z | move DX DY DZ | quit" << std::endl;
+
+  std::string buffer, line;
+  bool closed = false;
+  bool moved = true;
+  float reused = 0.f;
+  int spp = 0; // since the last move
+  while (true) {
+    if (moved || spp < PREVIEW_MAX_SPP) {
+      auto start = std::chrono::steady_clock::now();
+      int step_spp = moved ? options.preview_spp : 1;
+      cam.Render(scene, step_spp);
+      spp = moved ? step_spp : spp + step_spp;
+      std::string path = cam.CreateImage("preview", false);
+      double ms = 1000. * std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      std::cout << "\t" << path << ": " << spp << " spp";
+      if (moved) {
+        std::cout << ", " << (int)(100.f * reused) << "% of the pixels reprojected";
+      }
+      std::cout << ", " << (int)ms << " ms" << std::endl;
+      moved = false;
+      reused = 0.f;
+    }
+
+    // Commands that came in while rendering are all applied before the
+    // next image, only the last position matters
+    Vertex next_eye = eye;
+    bool quit = false;
+    while (!quit && ReadCommand(buffer, line, spp >= PREVIEW_MAX_SPP && next_eye == eye, closed)) {
+      std::stringstream ss(line);
+      std::string command;
+      Vertex v;
+      ss >> command;
+      if (command == "quit") {
+        quit = true;
+      } else if ((command == "eye" || command == "move") && (ss >> v.x >> v.y >> v.z)) {
+        Vertex target = command == "eye" ? v : next_eye + v;
+        if (target.x < 0.f) { // in front of the image plane at x = 0
+          next_eye = target;
+        } else {
+          std::cerr << "\tThe eye has to stay at x < 0" << std::endl;
+        }
+      } else if (!command.empty()) {
+        std::cerr << "\tUnknown preview command: " << line << std::endl;
+      }
+    }
+    if (quit) {
+      break;
+    }
+    if (next_eye != eye) {
+      reused = cam.MoveEye(scene, next_eye);
+      eye = next_eye;
+      moved = true;
+    } else if (closed) {
+      break; // the last move has been rendered
+    }
+  }
+  return true;
+}
+
+// Adds up the samples of all partial buffers and writes the final images.
+// The parts have to come from the same distributed render, each part once
+static bool MergeRenders(const std::string& name, const std::vector<std::string>& paths) {
+  if (paths.empty()) {
+    std::cerr << "\tNo partial buffers to merge" << std::endl;
+    return false;
+  }
+  Camera cam = Camera(Vertex(-2, 0, 0), Vertex(-1, 0, 0), Direction(1, 0, 0), Direction(0, 0, 1));
+  cam.ClearColorBuffer(COLOR_BLACK);
+  std::vector<Checkpoint> parts(paths.size());
+  long long samples = 0;
+  for (size_t i = 0; i < paths.size(); i++) {
+    std::cout << "\tMerging " << paths[i] << "..." << std::endl;
+    if (!cam.MergePartialRender(paths[i], parts[i])) {
+      std::cerr << "\tCould not merge " << paths[i] << std::endl;
+      return false;
+    }
+    const Checkpoint& part = parts[i];
+    if (!part.partial) {
+      std::cerr << "\t" << paths[i] << " is not the partial buffer of a worker" << std::endl;
+      return false;
+    }
+    if (part.seed != parts[0].seed || part.merged_spp != parts[0].merged_spp ||
+        part.tile_partition_count != parts[0].tile_partition_count) {
+      std::cerr << "\t" << paths[i] << " is part of a different render than " << paths[0] << std::endl;
+      return false;
+    }
+    // Parts of a tile partition differ in their tiles, the others in their
+    // sample range
+    for (size_t j = 0; j < i; j++) {
+      bool same_part = part.tile_partition_count > 1 ?
+          part.tile_partition_index == parts[j].tile_partition_index :
+          part.first_sample < parts[j].samples_rendered && parts[j].first_sample < part.samples_rendered;
+      if (same_part) {
+        std::cerr << "\t" << paths[i] << " overlaps with " << paths[j] << std::endl;
+        return false;
+      }
+    }
+    samples += part.samples_rendered - part.first_sample;
+  }
+  long long expected = (long long)parts[0].merged_spp * parts[0].tile_partition_count;
+  if (samples != expected) {
+    std::cerr << "\tWarning: the parts add up to " << samples << " samples instead of " << expected
+              << ", some are missing or unfinished" << std::endl;
+  }
+  std::cout << "\tCreating merged images..." << std::endl;
+  cam.CreateImage("mi_" + name, true);
+  cam.CreateImage("si_" + name, false);
+  cam.CreateHdrImage("hdr_" + name);
+  return true;
+}
+
+// Runs every worker in its own process on this machine, then merges them
+static bool RenderWithLocalWorkers(Options options) {
+#ifdef __unix__
+  int worker_count = options.local_workers;
+  std::vector<std::string> paths;
+  std::vector<pid_t> pids;
+  for (int k = 0; k < worker_count; k++) {
+    options.worker_index = k;
+    options.worker_count = worker_count;
+    options.output_path = PartialRenderPath(k, worker_count);
+    paths.push_back(options.output_path);
+    pid_t pid = fork();
+    if (pid == 0) {
+#ifdef _OPENMP
+      omp_set_num_threads(std::max(1, omp_get_num_procs() / worker_count));
+#endif
+      _exit(RenderImage(options) ? 0 : 1);
+    } else if (pid < 0) {
+      std::cerr << "\tCould not start worker " << k << std::endl;
+      return false;
+    }
+    pids.push_back(pid);
+  }
+  bool ok = true;
+  for (pid_t pid : pids) {
+    int status = 0;
+    waitpid(pid, &status, 0);
+    ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  }
+  if (!ok) {
+    std::cerr << "\tAt least one worker failed" << std::endl;
+    return false;
+  }
+  return MergeRenders(std::to_string(options.spp) + "spp_" + std::to_string(worker_count) +
+                      (options.partition_tiles ? "tileworkers" : "sampleworkers"), paths);
+#else
+  std::cerr << "\tLocal workers are only supported on UNIX systems" << std::endl;
+  return false;
+#endif
+}
+
+int main(int argc, char* argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, options)) {
+    PrintUsage();
+    return 1;
+  }
+
+  if (!options.submit_path.empty()) {
+    return RenderServer::Submit(options.submit_path, options.submit_command) ? 0 : 1;
+  }
+
+  std::cout << "GI-Ray to the rescue" << std::endl;
+
+  if (options.benchmark) {
+    Benchmark::Run();
+    return 0;
+  }
+  if (!options.serve_path.empty()) {
+    std::cout << "\tCreating scene..." << std::endl;
+    RenderServer server(options.serve_path);
+    return server.Run() ? 0 : 1;
+  }
+  if (options.preview) {
+    return RunPreview(options) ? 0 : 1;
+  }
+  if (!options.merge_name.empty()) {
+    return MergeRenders(options.merge_name, options.merge_paths) ? 0 : 1;
+  }
+  if (options.frames > 0) {
+    return options.spp > 0 && RenderAnimation(options) ? 0 : 1;
+  }
+  if (options.local_workers > 0) {
+    return options.spp > 0 && RenderWithLocalWorkers(options) ? 0 : 1;
+  }
+  if (argc > 1) {
+    if (options.spp <= 0 && options.resume_path.empty()) {
+      PrintUsage();
+      return 1;
+    }
+    return RenderImage(options) ? 0 : 1;
+  }
+
+  std::cout << "\nHow many samples/pixel do you want? ";
+  std::cin >> options.spp;
+
+  while (options.spp > 0) {
+    RenderImage(options);
 
     std::cout << "\nTo run again specify how many samples/pixel you want (enter '0' to quit): ";
-    std::cin >> spp;
+    std::cin >> options.spp;
   }
 
   std::cout << "\nGI-Ray finished without any problems" << std::endl;
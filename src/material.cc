@@ -12,4 +12,11 @@ Material::Material(float diffuse,
       emission_(emission) {
   float sum = diffuse_ + specular_ + transparence_;
   assert( sum <= 1.0f );
+  if (specular_ > 0.f) {
+    type_ = MATERIAL_MIRROR;
+  } else if (transparence_ > 0.f) {
+    type_ = MATERIAL_GLASS;
+  } else {
+    type_ = MATERIAL_LAMBERTIAN;
+  }
 }
@@ -0,0 +1,78 @@
+#include "numa.h"
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#ifdef __linux__
+  #include <sched.h>
+  #include <unistd.h>
+#endif
+
+const int MAX_NUMA_NODES = 64;
+
+std::vector<int> NumaTopology::ParseCpuList(const std::string& list) {
+  std::vector<int> cpus;
+  std::stringstream ss(list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    if (range.empty() || range == "\n") {
+      continue;
+    }
+    int first = atoi(range.c_str());
+    size_t dash = range.find('-');
+    int last = dash == std::string::npos ? first : atoi(range.c_str() + dash + 1);
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+NumaTopology NumaTopology::Detect() {
+  NumaTopology topology;
+#ifdef __linux__
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  bool has_mask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+  for (int node = 0; node < MAX_NUMA_NODES; node++) {
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    if (!file) {
+      continue; // node numbers can have gaps
+    }
+    std::string list;
+    std::getline(file, list);
+    std::vector<int> cpus;
+    for (int cpu : ParseCpuList(list)) {
+      if (!has_mask || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))) {
+        cpus.push_back(cpu);
+      }
+    }
+    if (!cpus.empty()) { // e.g. memory-only nodes
+      topology.node_cpus_.push_back(cpus);
+    }
+  }
+  if (topology.node_cpus_.empty()) {
+    std::vector<int> cpus;
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int cpu = 0; cpu < cpu_count; cpu++) {
+      if (!has_mask || CPU_ISSET(cpu, &allowed)) {
+        cpus.push_back(cpu);
+      }
+    }
+    topology.node_cpus_.push_back(cpus);
+  }
+#else
+  topology.node_cpus_.push_back(std::vector<int>(1, 0));
+#endif
+  return topology;
+}
+
+bool NumaTopology::PinThread(int cpu) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+  return false;
+#endif
+}
@@ -0,0 +1,185 @@
+#define _USE_MATH_DEFINES // Needed to run in windows/visual studio
+#include "photon_map.h"
+#include "scene.h"
+#include "raytracer.h"
+#include "ray.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+const int PARALLEL_BALANCE_THRESHOLD = 8192;
+const int MAX_PHOTON_LOOKUP = 256;
+
+struct CausticCaster {
+  Vertex center;
+  float radius;
+};
+
+PhotonMap::PhotonMap(std::vector<Photon> photons) : photons_(std::move(photons)) {
+  #pragma omp parallel
+  #pragma omp single
+  Balance(0, photons_.size());
+}
+
+void PhotonMap::Balance(int begin, int end) {
+  if (end - begin <= 1) {
+    if (end - begin == 1) {
+      photons_[begin].axis = 0;
+    }
+    return;
+  }
+  Vertex min = photons_[begin].position;
+  Vertex max = photons_[begin].position;
+  for (int i = begin + 1; i < end; i++) {
+    min = glm::min(min, photons_[i].position);
+    max = glm::max(max, photons_[i].position);
+  }
+  Direction extent = max - min;
+  unsigned char axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+  int mid = begin + (end - begin) / 2;
+  std::nth_element(photons_.begin() + begin, photons_.begin() + mid, photons_.begin() + end,
+                   [axis](const Photon& a, const Photon& b) { return a.position[axis] < b.position[axis]; });
+  photons_[mid].axis = axis;
+  if (end - begin > PARALLEL_BALANCE_THRESHOLD) {
+    #pragma omp task
+    Balance(begin, mid);
+    #pragma omp task
+    Balance(mid + 1, end);
+    #pragma omp taskwait
+  } else {
+    Balance(begin, mid);
+    Balance(mid + 1, end);
+  }
+}
+
+void PhotonMap::Locate(int begin, int end, Vertex position, int k, std::pair<float, int>* heap,
+                       int& heap_size, float& max_distance2) const {
+  if (begin >= end) {
+    return;
+  }
+  int mid = begin + (end - begin) / 2;
+  const Photon& photon = photons_[mid];
+  float delta = position[photon.axis] - photon.position[photon.axis];
+  if (delta < 0.f) {
+    Locate(begin, mid, position, k, heap, heap_size, max_distance2);
+  } else {
+    Locate(mid + 1, end, position, k, heap, heap_size, max_distance2);
+  }
+
+  Direction offset = position - photon.position;
+  float distance2 = glm::dot(offset, offset);
+  if (distance2 < max_distance2) {
+    heap[heap_size++] = std::make_pair(distance2, mid);
+    std::push_heap(heap, heap + heap_size);
+    if (heap_size > k) {
+      std::pop_heap(heap, heap + heap_size);
+      heap_size--;
+    }
+    if (heap_size == k) {
+      max_distance2 = heap[0].first;
+    }
+  }
+
+  // The far side can only hold closer photons if the split plane is closer
+  if (delta * delta < max_distance2) {
+    if (delta < 0.f) {
+      Locate(mid + 1, end, position, k, heap, heap_size, max_distance2);
+    } else {
+      Locate(begin, mid, position, k, heap, heap_size, max_distance2);
+    }
+  }
+}
+
+ColorDbl PhotonMap::EstimateIrradiance(Vertex position, Direction normal, int k, float max_radius) const {
+  if (photons_.empty()) {
+    return COLOR_BLACK;
+  }
+  k = std::min(k, MAX_PHOTON_LOOKUP);
+  std::pair<float, int> heap[MAX_PHOTON_LOOKUP + 1];
+  int heap_size = 0;
+  float max_distance2 = max_radius * max_radius;
+  Locate(0, photons_.size(), position, k, heap, heap_size, max_distance2);
+
+  ColorDbl power = COLOR_BLACK;
+  for (int i = 0; i < heap_size; i++) {
+    const Photon& photon = photons_[heap[i].second];
+    if (glm::dot(photon.direction, normal) < 0.f) {
+      power += photon.power;
+    }
+  }
+  return power / ((float)M_PI * max_distance2);
+}
+
+std::unique_ptr<PhotonMap> PhotonMap::BuildCausticMap(Scene& scene, int photon_count,
+                                                      unsigned int seed) {
+  std::vector<CausticCaster> casters;
+  for (auto& object : scene.get_objects()) {
+    CausticCaster caster;
+    if (object->GetCausticBounds(caster.center, caster.radius)) {
+      casters.push_back(caster);
+    }
+  }
+  const std::vector<Light*>& lights = scene.get_lights();
+  if (casters.empty() || lights.empty() || photon_count <= 0) {
+    return std::unique_ptr<PhotonMap>(new PhotonMap(std::vector<Photon>()));
+  }
+
+  // A caustic path ends at the first diffuse surface, so every emitted photon
+  // stores at most one photon. Keeping them in emission order makes the map
+  // independent of the thread scheduling.
+  std::vector<Photon> stored(photon_count);
+  std::vector<char> is_stored(photon_count, 0);
+  #pragma omp parallel
+  {
+    Raytracer raytracer;
+    #pragma omp for schedule(dynamic, 256)
+    for (int i = 0; i < photon_count; i++) {
+      Light& light = *lights[i % lights.size()];
+      Vertex origin = light.get_position();
+      raytracer.Seed(seed ^ (0x27d4eb2du * (unsigned int)(i + 1)));
+
+      // Aim at the bounding sphere of one caster (uniformly inside its cone)
+      // and weight by the pdf of the mixture over all casters, so photons
+      // aimed at overlapping cones are not counted twice
+      const CausticCaster& target = casters[(i / lights.size()) % casters.size()];
+      Direction axis = target.center - origin;
+      float distance = glm::length(axis);
+      axis = axis / distance;
+      float cos_max = distance > target.radius ?
+          sqrtf(1.f - target.radius * target.radius / (distance * distance)) : -1.f;
+      float cos_theta = 1.f - raytracer.Random() * (1.f - cos_max);
+      float sin_theta = sqrtf(std::max(0.f, 1.f - cos_theta * cos_theta));
+      float phi = 2.f * (float)M_PI * raytracer.Random();
+      Direction u_temp = fabs(axis.x) > .1f ? Direction(0.f,1.f,0.f) : Direction(1.f,0.f,0.f);
+      Direction u = glm::normalize(glm::cross(u_temp, axis));
+      Direction v = glm::cross(axis, u);
+      Direction direction = u * (cosf(phi) * sin_theta) + v * (sinf(phi) * sin_theta) + axis * cos_theta;
+
+      float pdf = 0.f;
+      for (const CausticCaster& caster : casters) {
+        Direction to_caster = caster.center - origin;
+        float caster_distance = glm::length(to_caster);
+        float caster_cos_max = caster_distance > caster.radius ?
+            sqrtf(1.f - caster.radius * caster.radius / (caster_distance * caster_distance)) : -1.f;
+        if (glm::dot(direction, to_caster) >= caster_cos_max * caster_distance) {
+          pdf += 1.f / (2.f * (float)M_PI * (1.f - caster_cos_max));
+        }
+      }
+      pdf /= casters.size();
+
+      // The point light intensity is per steradian
+      int photons_per_light = (photon_count + lights.size() - 1) / lights.size();
+      ColorDbl power = light.get_intensity() * light.get_color() / (pdf * photons_per_light);
+      Ray ray = Ray(origin, direction);
+      is_stored[i] = raytracer.TraceCausticPhoton(ray, power, scene, stored[i]);
+    }
+  }
+
+  std::vector<Photon> photons;
+  for (int i = 0; i < photon_count; i++) {
+    if (is_stored[i]) {
+      photons.push_back(stored[i]);
+    }
+  }
+  return std::unique_ptr<PhotonMap>(new PhotonMap(std::move(photons)));
+}
@@ -1,2 +1,35 @@
-//TODO: remove this file all together?
 #include "ray.h"
+#include <stdint.h>
+#include <string.h>
+#include <cmath>
+
+// Wächter & Binder, "A Fast and Robust Method for Avoiding Self-Intersection"
+// (Ray Tracing Gems, 2019). The offset is a fixed number of ulps, so it
+// grows with the rounding error of the hit position instead of being one
+// epsilon for every scale. Close to the origin, where ulps get tiny, a small
+// absolute offset is used instead
+const float OFFSET_ORIGIN_THRESHOLD = 1.f / 32.f;
+const float OFFSET_FLOAT_SCALE = 1.f / 65536.f;
+const float OFFSET_INT_SCALE = 256.f;
+
+static float OffsetUlps(float value, int ulps) {
+  int32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  bits += value < 0.f ? -ulps : ulps;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+Vertex Ray::OffsetOrigin(Vertex position, Direction normal, Direction direction) {
+  Direction n = glm::normalize(normal);
+  if (glm::dot(n, direction) < 0.f) {
+    n = -n;
+  }
+  Vertex origin;
+  for (int axis = 0; axis < 3; axis++) {
+    origin[axis] = std::abs(position[axis]) < OFFSET_ORIGIN_THRESHOLD
+        ? position[axis] + OFFSET_FLOAT_SCALE * n[axis]
+        : OffsetUlps(position[axis], (int)(OFFSET_INT_SCALE * n[axis]));
+  }
+  return origin;
+}
@@ -4,8 +4,12 @@
 #include "scene_object.h"
 // TODO: Remove when we have all point lights in vector
 #include "point_light.h"
+#include "irradiance_cache.h"
+#include "photon_map.h"
 #include <random>
 #include <iostream>
+#include <cfloat>
+#include <algorithm>
 
 // TODO: Place these somewhere that makes the most sense and remove some?
 const float EPSILON = 0.00001f;
@@ -15,23 +19,58 @@ const float CRITICAL_ANGLE = asin(REFRACTION_FACTOR_OI);
 const unsigned int MAX_DEPTH = 10; // What Max depth makes sense?
 const float gamma_factor = 3.6f;
 
-std::default_random_engine generator2;
-std::uniform_real_distribution<float> distribution2(0, 1);
+// Irradiance cache records use IRRADIANCE_THETA_STRATA x IRRADIANCE_PHI_STRATA
+// bounce rays and are valid for at least/most this many scene units
+const int IRRADIANCE_THETA_STRATA = 8;
+const int IRRADIANCE_PHI_STRATA = 24;
+const float IRRADIANCE_MIN_RADIUS = 0.1f;
+const float IRRADIANCE_MAX_RADIUS = 3.f;
 
-Raytracer::Raytracer() {}
+// A hit closer than this many origin offsets, on a surface facing the same
+// way, is the surface the ray left. Other close hits are concave corners
+const float SELF_HIT_OFFSETS = 4.f;
+const float SELF_HIT_MIN_COS = 0.999f;
+
+const int CAUSTIC_LOOKUP_PHOTONS = 64;
+const float CAUSTIC_LOOKUP_RADIUS = 0.25f;
+
+// Longest path of the bidirectional integrator, in bounces. Raytrace() leaves
+// out the 1/r^2 falloff of point lights, the bidirectional integrator does
+// not and makes them this much brighter to light the room about as much
+const int BDPT_MAX_DEPTH = 5;
+const float BDPT_LIGHT_SCALE = 8.f;
+
+Raytracer::Raytracer() : distribution_(0, 1), irradiance_cache_(nullptr), caustic_map_(nullptr),
+    find_diffuse_hit_(false), found_diffuse_hit_(false), self_hits_(0), leaks_(0), rays_(0) {}
+
+// Starts a ray on the side of the surface that direction leaves through
+static Ray SpawnRay(Vertex position, Direction normal, Direction direction) {
+  Vertex origin = Ray::OffsetOrigin(position, normal, direction);
+  Ray ray = Ray(origin, direction);
+  ray.origin_offset = glm::length(origin - position);
+  ray.origin_normal = glm::normalize(normal);
+  return ray;
+}
+
+// Every sample starts here, so this is also where the scratch memory of the
+// previous one is released
+void Raytracer::Seed(unsigned int seed) {
+  generator_.seed(seed);
+  distribution_.reset();
+  scratch_.Reset();
+}
 
 ColorDbl Raytracer::CalculateDirectIllumination(Ray& ray, IntersectionPoint& p, Scene& scene) {
-  const std::vector<std::unique_ptr<Light>>& lights = scene.get_lights();
+  const std::vector<Light*>& lights = scene.get_lights();
   ColorDbl color_accumulator = COLOR_BLACK;
   for (auto& light : lights) {
     Direction light_direction = light->get_position() - p.get_position();
 
     // Set dot product to zero if light is behind the surface
     Direction unit_surface_normal = glm::normalize(p.get_normal());
-    Vertex shadow_point_origin = p.get_position() + unit_surface_normal * 0.00001f;
 
     // Compute shadow ray
-    Ray shadow_ray = Ray(shadow_point_origin, light_direction);
+    Ray shadow_ray = SpawnRay(p.get_position(), unit_surface_normal, light_direction);
     bool in_shadow = CastShadowRay(shadow_ray, scene, light_direction);
 
     if (!in_shadow) {
@@ -40,34 +79,50 @@ ColorDbl Raytracer::CalculateDirectIllumination(Ray& ray, IntersectionPoint& p,
       color_accumulator += light->get_intensity() * light->get_color() * l_dot_n;
     }
   }
+  if (caustic_map_) {
+    color_accumulator += caustic_map_->EstimateIrradiance(p.get_position(), glm::normalize(p.get_normal()),
+                                                          CAUSTIC_LOOKUP_PHOTONS, CAUSTIC_LOOKUP_RADIUS);
+  }
   return color_accumulator * p.get_material().get_color();
 }
 
-ColorDbl Raytracer::Shade(Ray& ray, IntersectionPoint& p, Scene& scene, unsigned int& depth) {
-  if (depth > MAX_DEPTH || ray.get_importance() < 0.05) {
-    return CalculateDirectIllumination(ray, p, scene);
-  }
-  if (p.get_material().get_specular() > 0.f) {
-    Direction n = glm::normalize(p.get_normal());
-    Direction d = ray.get_direction();
+template <>
+ColorDbl Raytracer::ShadeKernel<MATERIAL_MIRROR>(Ray& ray, IntersectionPoint& p, Scene& scene, unsigned int& depth) {
+  Direction n = glm::normalize(p.get_normal());
+  Direction d = ray.get_direction();
 
-    Vertex reflection_point_origin = p.get_position() + n * 0.00001f;
-    Direction reflection_direction = d - 2*(glm::dot(d, n))*n;
-    Ray reflection_ray = Ray(reflection_point_origin, reflection_direction);
-    reflection_ray.has_hit_diffuse = ray.has_hit_diffuse;
-    return Raytrace(reflection_ray, scene, depth + 1);
-  }
-  if (p.get_material().get_transparence() > 0.f) { // If object has refractive component
-    return p.get_material().get_color() * HandleRefraction(ray, p, scene, depth);
-  }
+  Direction reflection_direction = d - 2*(glm::dot(d, n))*n;
+  Ray reflection_ray = SpawnRay(p.get_position(), n, reflection_direction);
+  reflection_ray.has_hit_diffuse = ray.has_hit_diffuse;
+  return Raytrace(reflection_ray, scene, depth + 1);
+}
 
+template <>
+ColorDbl Raytracer::ShadeKernel<MATERIAL_GLASS>(Ray& ray, IntersectionPoint& p, Scene& scene, unsigned int& depth) {
+  return p.get_material().get_color() * HandleRefraction(ray, p, scene, depth);
+}
+
+template <>
+ColorDbl Raytracer::ShadeKernel<MATERIAL_LAMBERTIAN>(Ray& ray, IntersectionPoint& p, Scene& scene, unsigned int& depth) {
   //STOP ON SECOND DIFFUSE HIT
   if (ray.has_hit_diffuse) {
     return CalculateDirectIllumination(ray, p, scene);
   }
+  if (find_diffuse_hit_) {
+    found_diffuse_hit_ = true;
+    diffuse_hit_position_ = p.get_position();
+    diffuse_hit_normal_ = glm::normalize(p.get_normal());
+    return COLOR_BLACK;
+  }
   ray.has_hit_diffuse = true;
-  float r1 = 2.f * (float)M_PI * distribution2(generator2);
-  float r2 = distribution2(generator2);
+
+  ColorDbl irradiance;
+  if (irradiance_cache_ &&
+      irradiance_cache_->Lookup(p.get_position(), glm::normalize(p.get_normal()), irradiance)) {
+    return CalculateDirectIllumination(ray, p, scene) * irradiance;
+  }
+  float r1 = 2.f * (float)M_PI * Random();
+  float r2 = Random();
   float r2s = sqrtf(r2);
 
   Direction w = glm::normalize(p.get_normal());
@@ -77,19 +132,235 @@ ColorDbl Raytracer::Shade(Ray& ray, IntersectionPoint& p, Scene& scene, unsigned
   Direction v = glm::cross(w, u);
   Direction d = glm::normalize(u * (float)cos(r1) * r2s + v*(float)sin(r1) * r2s + w * sqrtf(1 - r2));
 
-  Direction n = glm::normalize(p.get_normal());
-  Vertex reflection_point_origin = p.get_position() + n * 0.00001f;
-  Ray new_ray = Ray(reflection_point_origin, d);
+  Ray new_ray = SpawnRay(p.get_position(), w, d);
   new_ray.has_hit_diffuse = ray.has_hit_diffuse;
 
   //TODO why are we multiplying here? Shouldn't it be addition?
   return CalculateDirectIllumination(ray, p, scene) * Raytrace(new_ray, scene, depth + 1);
 }
 
+ColorDbl Raytracer::Shade(Ray& ray, IntersectionPoint& p, Scene& scene, unsigned int& depth) {
+  if (depth > MAX_DEPTH || ray.get_importance() < 0.05) {
+    return CalculateDirectIllumination(ray, p, scene);
+  }
+  switch (p.get_material().get_type()) {
+    case MATERIAL_MIRROR:
+      return ShadeKernel<MATERIAL_MIRROR>(ray, p, scene, depth);
+    case MATERIAL_GLASS:
+      return ShadeKernel<MATERIAL_GLASS>(ray, p, scene, depth);
+    default:
+      return ShadeKernel<MATERIAL_LAMBERTIAN>(ray, p, scene, depth);
+  }
+}
+
+template <MaterialType type>
+void Raytracer::ShadeRange(Ray* rays, IntersectionPoint** hits, const int* order, int count,
+                           Scene& scene, unsigned int& depth, ColorDbl* colors) {
+  for (int i = 0; i < count; i++) {
+    int idx = order[i];
+    colors[idx] = depth > MAX_DEPTH || rays[idx].get_importance() < 0.05
+        ? CalculateDirectIllumination(rays[idx], *hits[idx], scene)
+        : ShadeKernel<type>(rays[idx], *hits[idx], scene, depth);
+  }
+}
+
+void Raytracer::ShadeBatch(Ray* rays, IntersectionPoint** hits, int count, Scene& scene,
+                           unsigned int& depth, ColorDbl* colors) {
+  // Counting sort of the hits by material, misses are black
+  int counts[MATERIAL_TYPE_COUNT] = { 0 };
+  for (int i = 0; i < count; i++) {
+    if (hits[i]) {
+      counts[hits[i]->get_material().get_type()]++;
+    } else {
+      colors[i] = COLOR_BLACK;
+    }
+  }
+  int starts[MATERIAL_TYPE_COUNT];
+  int start = 0;
+  for (int type = 0; type < MATERIAL_TYPE_COUNT; type++) {
+    starts[type] = start;
+    start += counts[type];
+  }
+  std::vector<int> order(start);
+  int fill[MATERIAL_TYPE_COUNT];
+  std::copy(starts, starts + MATERIAL_TYPE_COUNT, fill);
+  for (int i = 0; i < count; i++) {
+    if (hits[i]) {
+      order[fill[hits[i]->get_material().get_type()]++] = i;
+    }
+  }
+  ShadeRange<MATERIAL_LAMBERTIAN>(rays, hits, order.data() + starts[MATERIAL_LAMBERTIAN],
+                                  counts[MATERIAL_LAMBERTIAN], scene, depth, colors);
+  ShadeRange<MATERIAL_MIRROR>(rays, hits, order.data() + starts[MATERIAL_MIRROR],
+                              counts[MATERIAL_MIRROR], scene, depth, colors);
+  ShadeRange<MATERIAL_GLASS>(rays, hits, order.data() + starts[MATERIAL_GLASS],
+                             counts[MATERIAL_GLASS], scene, depth, colors);
+}
+
+bool Raytracer::FindFirstHit(Ray& ray, Scene& scene, Vertex& position, bool& diffuse) {
+  scratch_.Reset();
+  IntersectionPoint* p = GetClosestIntersectionPoint(ray, scene);
+  if (!p) {
+    return false;
+  }
+  position = p->get_position();
+  diffuse = p->get_material().get_type() == MATERIAL_LAMBERTIAN;
+  return true;
+}
+
+bool Raytracer::FindFirstDiffuseHit(Ray& ray, Scene& scene, Vertex& position, Direction& normal) {
+  scratch_.Reset();
+  find_diffuse_hit_ = true;
+  found_diffuse_hit_ = false;
+  Raytrace(ray, scene, 0);
+  find_diffuse_hit_ = false;
+  position = diffuse_hit_position_;
+  normal = diffuse_hit_normal_;
+  return found_diffuse_hit_;
+}
+
+IrradianceRecord Raytracer::ComputeIrradianceRecord(Vertex position, Direction normal, Scene& scene) {
+  const int M = IRRADIANCE_THETA_STRATA;
+  const int N = IRRADIANCE_PHI_STRATA;
+  Direction w = normal;
+  Direction u_temp = fabs(w.x) > .1f ? Direction(0.f,1.f,0.f) : Direction(1.f,0.f,0.f);
+  Direction u = glm::normalize(glm::cross(u_temp, w));
+  Direction v = glm::cross(w, u);
+
+  // Cosine weighted strata: sin^2(theta) and phi are uniform
+  std::vector<ColorDbl> radiance(M * N);
+  std::vector<float> distance(M * N);
+  std::vector<float> theta(M * N);
+  IrradianceRecord record;
+  record.position = position;
+  record.normal = normal;
+  record.irradiance = COLOR_BLACK;
+  float inverse_distance_sum = 0.f;
+  unsigned int depth = 1;
+  std::vector<Ray> bounce_rays;
+  std::vector<IntersectionPoint*> hits(M * N);
+  bounce_rays.reserve(M * N);
+  for (int j = 0; j < M; j++) {
+    for (int k = 0; k < N; k++) {
+      float sin_theta = sqrtf((j + Random()) / M);
+      float phi = 2.f * (float)M_PI * (k + Random()) / N;
+      Direction d = u * (cosf(phi) * sin_theta) + v * (sinf(phi) * sin_theta) +
+          w * sqrtf(std::max(0.f, 1.f - sin_theta * sin_theta));
+      int idx = j * N + k;
+      bounce_rays.push_back(SpawnRay(position, normal, d));
+      bounce_rays[idx].has_hit_diffuse = true;
+      hits[idx] = GetClosestIntersectionPoint(bounce_rays[idx], scene);
+      distance[idx] = hits[idx] ? std::max(hits[idx]->get_z(), 1e-4f) : FLT_MAX;
+      theta[idx] = asinf(sin_theta);
+      inverse_distance_sum += 1.f / distance[idx];
+    }
+  }
+  ShadeBatch(bounce_rays.data(), hits.data(), M * N, scene, depth, radiance.data());
+  for (int idx = 0; idx < M * N; idx++) {
+    record.irradiance += radiance[idx];
+  }
+  record.irradiance /= (float)(M * N);
+  record.radius = inverse_distance_sum > 0.f ? (M * N) / inverse_distance_sum : IRRADIANCE_MAX_RADIUS;
+
+  // Irradiance gradients, divided by pi since the irradiance is stored as
+  // the mean incoming radiance
+  for (int c = 0; c < 3; c++) {
+    record.rotational_gradient[c] = Direction(0.f, 0.f, 0.f);
+    record.translational_gradient[c] = Direction(0.f, 0.f, 0.f);
+  }
+  for (int k = 0; k < N; k++) {
+    float phi_center = 2.f * (float)M_PI * (k + 0.5f) / N;
+    float phi_min = 2.f * (float)M_PI * k / N;
+    Direction u_k = u * cosf(phi_center) + v * sinf(phi_center);
+    Direction v_k = -u * sinf(phi_center) + v * cosf(phi_center);
+    Direction v_k_min = -u * sinf(phi_min) + v * cosf(phi_min);
+    int k_prev = (k + N - 1) % N;
+    for (int j = 0; j < M; j++) {
+      int idx = j * N + k;
+      float sin_theta_min = sqrtf((float)j / M);
+      float sin_theta_max = sqrtf((float)(j + 1) / M);
+      ColorDbl rotational = -tanf(theta[idx]) * radiance[idx] / (float)(M * N);
+      // Movement across the constant phi cell border towards k - 1
+      ColorDbl across_phi = (sin_theta_max - sin_theta_min) /
+          std::min(distance[idx], distance[j * N + k_prev]) / (float)M_PI *
+          (radiance[idx] - radiance[j * N + k_prev]);
+      // Movement across the constant theta cell border towards j - 1
+      ColorDbl across_theta = COLOR_BLACK;
+      if (j > 0) {
+        float cos2_theta_min = 1.f - sin_theta_min * sin_theta_min;
+        across_theta = 2.f / N * sin_theta_min * cos2_theta_min /
+            std::min(distance[idx], distance[idx - N]) * (radiance[idx] - radiance[idx - N]);
+      }
+      for (int c = 0; c < 3; c++) {
+        record.rotational_gradient[c] += v_k * rotational[c];
+        record.translational_gradient[c] += u_k * across_theta[c] + v_k_min * across_phi[c];
+      }
+    }
+  }
+
+  // Keep the record from being extrapolated further than its gradient allows
+  float mean_irradiance = (record.irradiance.x + record.irradiance.y + record.irradiance.z) / 3.f;
+  float gradient_length = glm::length((record.translational_gradient[0] +
+                                       record.translational_gradient[1] +
+                                       record.translational_gradient[2]) / 3.f);
+  if (gradient_length > 0.f) {
+    record.radius = std::min(record.radius, mean_irradiance / gradient_length);
+  }
+  record.radius = glm::clamp(record.radius, IRRADIANCE_MIN_RADIUS, IRRADIANCE_MAX_RADIUS);
+  return record;
+}
+
+bool Raytracer::TraceCausticPhoton(Ray& ray, ColorDbl power, Scene& scene, Photon& photon) {
+  bool has_hit_specular = false;
+  float path_length = 0.f;
+  Ray photon_ray = ray;
+  // Same material logic as Shade(), so the caustics match what camera rays see
+  for (unsigned int depth = 0; depth <= MAX_DEPTH; depth++) {
+    IntersectionPoint* p = GetClosestIntersectionPoint(photon_ray, scene);
+    if (!p) {
+      return false;
+    }
+    path_length += p->get_z();
+    MaterialType type = p->get_material().get_type();
+    if (type == MATERIAL_MIRROR) {
+      Direction n = glm::normalize(p->get_normal());
+      Direction d = photon_ray.get_direction();
+      photon_ray = SpawnRay(p->get_position(), n, d - 2*(glm::dot(d, n))*n);
+      has_hit_specular = true;
+    } else if (type == MATERIAL_GLASS) {
+      Ray refraction_ray = photon_ray;
+      if (!GetRefractedRay(photon_ray, *p, refraction_ray)) {
+        return false;
+      }
+      power *= p->get_material().get_color() * p->get_material().get_transparence();
+      photon_ray = refraction_ray;
+      has_hit_specular = true;
+    } else {
+      if (!has_hit_specular) {
+        return false;
+      }
+      // Direct light in CalculateDirectIllumination() does not fall off with
+      // distance, so neither do the photons
+      photon.position = p->get_position();
+      photon.power = power * path_length * path_length;
+      photon.direction = photon_ray.get_direction();
+      return true;
+    }
+  }
+  return false;
+}
 
 // TODO: Refactor later
 // Done - according to lecture4 slides
 ColorDbl Raytracer::HandleRefraction(Ray& ray, IntersectionPoint& p, Scene& scene, unsigned int& depth) {
+  Ray refraction_ray = ray;
+  if (!GetRefractedRay(ray, p, refraction_ray)) {
+    return COLOR_BLACK;
+  }
+  return p.get_material().get_transparence() * Raytrace(refraction_ray, scene, depth + 1);
+}
+
+bool Raytracer::GetRefractedRay(Ray& ray, IntersectionPoint& p, Ray& refraction_ray) {
   //TODO: check why these normalizations are NOT redundant
   Direction n = glm::normalize(p.get_normal());
   Direction I = ray.get_direction();
@@ -101,11 +372,10 @@ ColorDbl Raytracer::HandleRefraction(Ray& ray, IntersectionPoint& p, Scene& scen
   if ( !is_inside_object ) {
     Direction T = REFRACTION_FACTOR_OI * I - n*(REFRACTION_FACTOR_OI*I_dot_n +
         sqrtf(1 - REFRACTION_FACTOR_OI*REFRACTION_FACTOR_OI * (1 - I_dot_n*I_dot_n)));
-    Vertex refraction_point_origin = p.get_position() - n * EPSILON;
-    Ray refraction_ray = Ray(refraction_point_origin, T);
+    refraction_ray = SpawnRay(p.get_position(), n, T);
     refraction_ray.has_hit_diffuse = ray.has_hit_diffuse;
     refraction_ray.set_refraction_status(true);
-    return p.get_material().get_transparence() * Raytrace(refraction_ray, scene, depth + 1);
+    return true;
   } else { // we are inside of a glass object, trying to go outside
     n = -n; // because we are at the inside of the object now
     // calculate angle between normal and incoming ray direction
@@ -114,15 +384,14 @@ ColorDbl Raytracer::HandleRefraction(Ray& ray, IntersectionPoint& p, Scene& scen
     float alpha = acos(I_dot_n);
 
     if ( alpha > CRITICAL_ANGLE ) { // if total inner reflection
-      Vertex inner_reflection_ray_origin = p.get_position() + n * EPSILON;
       Direction reflection_direction = I - 2.f*(glm::dot(I, n))*n;
-      Ray total_inner_reflection_ray = Ray(inner_reflection_ray_origin, reflection_direction);
-      total_inner_reflection_ray.has_hit_diffuse = ray.has_hit_diffuse;
-      total_inner_reflection_ray.set_refraction_status(true);
-      return p.get_material().get_transparence() * Raytrace(total_inner_reflection_ray, scene, depth + 1);
+      refraction_ray = SpawnRay(p.get_position(), n, reflection_direction);
+      refraction_ray.has_hit_diffuse = ray.has_hit_diffuse;
+      refraction_ray.set_refraction_status(true);
+      return true;
     } else if ( CRITICAL_ANGLE == alpha ) {
       std::cerr << "THIS SHOULD NEVER (or at least very rarely) BE PRINTED!!!!!" << std::endl;
-      return COLOR_BLACK;
+      return false;
     }
     // else exiting glass object!
     Direction T = REFRACTION_FACTOR_IO * I - n*(-REFRACTION_FACTOR_IO*I_dot_n +
@@ -131,49 +400,260 @@ ColorDbl Raytracer::HandleRefraction(Ray& ray, IntersectionPoint& p, Scene& scen
     if ( 1.0f - glm::length(T) > EPSILON ) {
       std::cerr << "THIS SHOULD NOT BE PRINTED! Length of T = " << glm::length(T) << std::endl;
     }
-    Vertex outgoing_refraction_ray_origin = p.get_position() - n * EPSILON;
-    Ray refraction_ray = Ray(outgoing_refraction_ray_origin, T);
+    refraction_ray = SpawnRay(p.get_position(), n, T);
     refraction_ray.has_hit_diffuse = ray.has_hit_diffuse;
     refraction_ray.set_refraction_status(false);
-    return p.get_material().get_transparence() * Raytrace(refraction_ray, scene, depth + 1);
+    return true;
   }
 }
 
-std::unique_ptr<IntersectionPoint> Raytracer::GetClosestIntersectionPoint(Ray& ray, Scene& scene) {
-  const std::vector<std::unique_ptr<SceneObject>>& objects = scene.get_objects();
-  std::unique_ptr<IntersectionPoint> return_point;
-
-  //To make sure we update the z_buffer upon collision.
-  float z_buffer = FLT_MAX;
-  for (auto& object : objects) {
-    std::unique_ptr<IntersectionPoint> p = object->RayIntersection(ray);
-    if (p && p->get_z() < z_buffer) {
-      z_buffer = p->get_z();
-      return_point = std::move(p);
-    }
+// The scene is closed, so a ray that hits nothing leaked through a crack
+// between triangles, and one that hits right next to its origin found the
+// surface it was leaving
+IntersectionPoint* Raytracer::GetClosestIntersectionPoint(Ray& ray, Scene& scene) {
+  rays_++;
+  IntersectionPoint* p = scene.ClosestIntersection(ray, scratch_);
+  if (!p) {
+    leaks_++;
+  } else if (p->get_z() < SELF_HIT_OFFSETS * ray.origin_offset &&
+             std::abs(glm::dot(glm::normalize(p->get_normal()), ray.origin_normal)) > SELF_HIT_MIN_COS) {
+    self_hits_++;
   }
-  return return_point;
+  return p;
 }
 
 bool Raytracer::CastShadowRay(Ray& ray, Scene& scene, Direction& light_direction) {
-  const std::vector<std::unique_ptr<SceneObject>>& objects = scene.get_objects();
-  float z_buffer = FLT_MAX;
-  for (auto& object : objects) {
-    std::unique_ptr<IntersectionPoint> p = object->RayIntersection(ray);
-    if (p && p->get_z() < glm::length(light_direction) &&
-        p->get_material().get_transparence() == 0.f) {
-      return true;
-    }
-  }
-  return false;
+  rays_++;
+  return scene.Occluded(ray, glm::length(light_direction), scratch_);
 }
 
 ColorDbl Raytracer::Raytrace(Ray& ray, Scene& scene, unsigned int depth) {
-  float z_buffer = FLT_MAX;
-  std::unique_ptr<IntersectionPoint> intersection_point = GetClosestIntersectionPoint(ray, scene);
+  IntersectionPoint* intersection_point = GetClosestIntersectionPoint(ray, scene);
   if (intersection_point) {
     return Shade(ray, *intersection_point, scene, depth);
   }
-  std::cerr << "\nLigg här och gnag... " << std::endl;
   return COLOR_BLACK;
-}
\ No newline at end of file
+}
+// Converts a solid angle density at from into an area density at to
+static float ToAreaDensity(float pdf_dir, const PathVertex& from, const PathVertex& to) {
+  Direction d = to.position - from.position;
+  float distance2 = glm::dot(d, d);
+  if (distance2 == 0.f) {
+    return 0.f;
+  }
+  float pdf = pdf_dir / distance2;
+  if (to.material) {
+    pdf *= std::abs(glm::dot(to.normal, d)) / sqrtf(distance2);
+  }
+  return pdf;
+}
+
+// Cosine weighted, like the bounces of Raytrace(), so the density of
+// sampling to when coming from from is |cos| / pi on the same side
+static float DiffusePdf(Direction normal, Direction from, Direction to) {
+  float cos_from = glm::dot(normal, from);
+  float cos_to = glm::dot(normal, to);
+  return cos_from * cos_to > 0.f ? std::abs(cos_to) / (float)M_PI : 0.f;
+}
+
+static ColorDbl DiffuseBsdf(const PathVertex& v, Direction to) {
+  return glm::dot(v.normal, v.incoming) * glm::dot(v.normal, to) > 0.f ?
+      v.material->get_color() / (float)M_PI : COLOR_BLACK;
+}
+
+// Refracts d through a glass surface whose normal may face either way, or
+// reflects it if it cannot get out
+static Direction Refract(Direction d, Direction n) {
+  float cos_i = -glm::dot(d, n);
+  float eta = REFRACTION_FACTOR_OI;
+  if (cos_i < 0.f) {
+    n = -n;
+    cos_i = -cos_i;
+    eta = REFRACTION_FACTOR_IO;
+  }
+  float k = 1.f - eta * eta * (1.f - cos_i * cos_i);
+  if (k < 0.f) {
+    return d + 2.f * cos_i * n;
+  }
+  return eta * d + (eta * cos_i - sqrtf(k)) * n;
+}
+
+static float Remap0(float pdf) {
+  return pdf != 0.f ? pdf : 1.f;
+}
+
+int Raytracer::RandomWalk(Ray ray, ColorDbl beta, float pdf_dir, PathVertex* path, int max_vertices, Scene& scene) {
+  int count = 1;
+  while (count < max_vertices) {
+    IntersectionPoint* p = GetClosestIntersectionPoint(ray, scene);
+    if (!p) {
+      break;
+    }
+    PathVertex& previous = path[count - 1];
+    PathVertex& vertex = path[count++];
+    vertex.position = p->get_position();
+    vertex.normal = glm::normalize(p->get_normal());
+    vertex.incoming = -ray.get_direction();
+    vertex.material = &p->get_material();
+    vertex.beta = beta;
+    vertex.delta = vertex.material->get_type() != MATERIAL_LAMBERTIAN;
+    vertex.pdf_fwd = ToAreaDensity(pdf_dir, previous, vertex);
+    vertex.pdf_rev = 0.f;
+    if (count == max_vertices) {
+      break;
+    }
+
+    // Specular bounces have no density, and count as 0 in the MIS weights
+    Direction direction;
+    float pdf_rev_dir = 0.f;
+    switch (vertex.material->get_type()) {
+      case MATERIAL_MIRROR:
+        direction = ray.get_direction() - 2.f * glm::dot(ray.get_direction(), vertex.normal) * vertex.normal;
+        beta *= vertex.material->get_color();
+        pdf_dir = 0.f;
+        break;
+      case MATERIAL_GLASS:
+        direction = Refract(ray.get_direction(), vertex.normal);
+        beta *= vertex.material->get_color() * vertex.material->get_transparence();
+        pdf_dir = 0.f;
+        break;
+      default: {
+        float r1 = 2.f * (float)M_PI * Random();
+        float r2 = Random();
+        float r2s = sqrtf(r2);
+        Direction w = glm::dot(vertex.normal, vertex.incoming) > 0.f ? vertex.normal : -vertex.normal;
+        Direction u_temp = fabs(w.x) > .1f ? Direction(0.f,1.f,0.f) : Direction(1.f,0.f,0.f);
+        Direction u = glm::normalize(glm::cross(u_temp, w));
+        Direction v = glm::cross(w, u);
+        direction = glm::normalize(u * cosf(r1) * r2s + v * sinf(r1) * r2s + w * sqrtf(1 - r2));
+        // f * cos / pdf of a cosine weighted bounce is the albedo
+        beta *= vertex.material->get_color();
+        pdf_dir = glm::dot(w, direction) / (float)M_PI;
+        pdf_rev_dir = glm::dot(w, vertex.incoming) / (float)M_PI;
+        break;
+      }
+    }
+    previous.pdf_rev = ToAreaDensity(pdf_rev_dir, vertex, previous);
+    ray = SpawnRay(vertex.position, vertex.normal, direction);
+  }
+  return count;
+}
+
+ColorDbl Raytracer::Connect(PathVertex* camera_path, int t, PathVertex* light_path, int s, Scene& scene) {
+  const PathVertex& pt = camera_path[t - 1];
+  const PathVertex& qs = light_path[s - 1];
+  if (pt.delta || qs.delta) {
+    return COLOR_BLACK;
+  }
+  Direction d = qs.position - pt.position;
+  float distance2 = glm::dot(d, d);
+  if (distance2 == 0.f) {
+    return COLOR_BLACK;
+  }
+  Direction to_qs = d / sqrtf(distance2);
+  // The first light vertex is the point light, which shines the same way
+  // in every direction
+  ColorDbl contribution = pt.beta * DiffuseBsdf(pt, to_qs) * qs.beta *
+      std::abs(glm::dot(pt.normal, to_qs)) / distance2;
+  if (s > 1) {
+    contribution *= DiffuseBsdf(qs, -to_qs) * std::abs(glm::dot(qs.normal, to_qs));
+  }
+  if (contribution == COLOR_BLACK) {
+    return COLOR_BLACK;
+  }
+  // Glass blocks connections too, light only gets through it by refraction
+  Vertex origin = Ray::OffsetOrigin(pt.position, pt.normal, to_qs);
+  Vertex target = qs.material ? Ray::OffsetOrigin(qs.position, qs.normal, -to_qs) : qs.position;
+  Ray shadow_ray = Ray(origin, target - origin);
+  rays_++;
+  if (scene.Occluded(shadow_ray, glm::length(target - origin), scratch_, true)) {
+    return COLOR_BLACK;
+  }
+  return contribution;
+}
+
+// Balance heuristic over all strategies that could have made the same path,
+// found from the ratios of their densities as in Veach's thesis. The four
+// vertices next to the connection get the reverse densities of the
+// connected path while the weight is computed
+float Raytracer::BidirectionalMisWeight(PathVertex* camera_path, int t, PathVertex* light_path, int s) {
+  PathVertex& pt = camera_path[t - 1];
+  PathVertex& qs = light_path[s - 1];
+  PathVertex& pt_minus = camera_path[t - 2];
+  float saved[4] = { pt.pdf_rev, pt_minus.pdf_rev, qs.pdf_rev, s > 1 ? light_path[s - 2].pdf_rev : 0.f };
+
+  Direction to_qs = glm::normalize(qs.position - pt.position);
+  pt.pdf_rev = s == 1 ? ToAreaDensity(1.f / (4.f * (float)M_PI), qs, pt)
+                      : ToAreaDensity(DiffusePdf(qs.normal, qs.incoming, -to_qs), qs, pt);
+  pt_minus.pdf_rev = ToAreaDensity(DiffusePdf(pt.normal, to_qs, pt.incoming), pt, pt_minus);
+  qs.pdf_rev = ToAreaDensity(DiffusePdf(pt.normal, pt.incoming, to_qs), pt, qs);
+  if (s > 1) {
+    light_path[s - 2].pdf_rev = ToAreaDensity(DiffusePdf(qs.normal, -to_qs, qs.incoming), qs, light_path[s - 2]);
+  }
+
+  // Fewer camera vertices, down to two since connecting light subpaths to
+  // the camera (t = 1) is not one of the strategies
+  float sum = 0.f;
+  float ratio = 1.f;
+  for (int i = t - 1; i > 1; i--) {
+    ratio *= Remap0(camera_path[i].pdf_rev) / Remap0(camera_path[i].pdf_fwd);
+    if (!camera_path[i].delta && !camera_path[i - 1].delta) {
+      sum += ratio;
+    }
+  }
+  // Fewer light vertices, down to one since no path can hit a point light
+  ratio = 1.f;
+  for (int i = s - 1; i >= 0; i--) {
+    ratio *= Remap0(light_path[i].pdf_rev) / Remap0(light_path[i].pdf_fwd);
+    if (i > 0 && !light_path[i].delta && !light_path[i - 1].delta) {
+      sum += ratio;
+    }
+  }
+
+  pt.pdf_rev = saved[0];
+  pt_minus.pdf_rev = saved[1];
+  qs.pdf_rev = saved[2];
+  if (s > 1) {
+    light_path[s - 2].pdf_rev = saved[3];
+  }
+  return 1.f / (1.f + sum);
+}
+
+ColorDbl Raytracer::TraceBidirectional(Ray& ray, Scene& scene) {
+  const std::vector<Light*>& lights = scene.get_lights();
+  if (lights.empty()) {
+    return COLOR_BLACK;
+  }
+  // The camera vertex only matters to the t = 1 strategies, so its
+  // densities are never used
+  PathVertex camera_path[BDPT_MAX_DEPTH + 2];
+  camera_path[0] = { ray.get_origin(), Direction(0.f), Direction(0.f), nullptr, COLOR_WHITE, 1.f, 0.f, false };
+  int camera_vertices = RandomWalk(ray, COLOR_WHITE, 1.f, camera_path, BDPT_MAX_DEPTH + 2, scene);
+
+  // One light per sample, emitting uniformly over the sphere
+  int light_index = std::min((int)lights.size() - 1, (int)(Random() * lights.size()));
+  Light* light = lights[light_index];
+  float light_pdf = 1.f / lights.size();
+  float pdf_dir = 1.f / (4.f * (float)M_PI);
+  ColorDbl intensity = BDPT_LIGHT_SCALE * light->get_intensity() * light->get_color();
+  PathVertex light_path[BDPT_MAX_DEPTH + 1];
+  light_path[0] = { light->get_position(), Direction(0.f), Direction(0.f), nullptr,
+                    intensity / light_pdf, light_pdf, 0.f, false };
+  float cos_theta = 1.f - 2.f * Random();
+  float sin_theta = sqrtf(std::max(0.f, 1.f - cos_theta * cos_theta));
+  float phi = 2.f * (float)M_PI * Random();
+  Ray light_ray = Ray(light->get_position(), Direction(sin_theta * cosf(phi), sin_theta * sinf(phi), cos_theta));
+  int light_vertices = RandomWalk(light_ray, light_path[0].beta / pdf_dir, pdf_dir, light_path,
+                                  BDPT_MAX_DEPTH + 1, scene);
+
+  ColorDbl color = COLOR_BLACK;
+  for (int t = 2; t <= camera_vertices; t++) {
+    for (int s = 1; s <= light_vertices && s + t - 2 <= BDPT_MAX_DEPTH; s++) {
+      ColorDbl contribution = Connect(camera_path, t, light_path, s, scene);
+      if (contribution != COLOR_BLACK) {
+        color += BidirectionalMisWeight(camera_path, t, light_path, s) * contribution;
+      }
+    }
+  }
+  return color;
+}
@@ -0,0 +1,277 @@
+#include "render_server.h"
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <cstdlib>
+#include <cerrno>
+#include <stdio.h>
+#include <string.h>
+#ifdef __unix__
+  #include <signal.h>
+  #include <sys/socket.h>
+  #include <sys/stat.h>
+  #include <sys/un.h>
+  #include <unistd.h>
+#endif
+
+const int MAX_COMMAND_LENGTH = 4096;
+const int MAX_JOB_RESOLUTION = 8192;
+const int MAX_JOB_SPP = 1000000;
+const int MAX_JOB_CAUSTIC_PHOTONS = 10000000;
+
+bool RenderJob::Parse(const std::string& words, RenderJob& job, std::string& error) {
+  std::stringstream ss(words);
+  std::string word;
+  while (ss >> word) {
+    size_t equals = word.find('=');
+    if (equals == std::string::npos) {
+      error = "expected key=value, got " + word;
+      return false;
+    }
+    std::string key = word.substr(0, equals);
+    std::string value = word.substr(equals + 1);
+    bool ok = true;
+    if (key == "spp") {
+      job.spp = std::atoi(value.c_str());
+      ok = job.spp > 0 && job.spp <= MAX_JOB_SPP;
+    } else if (key == "width") {
+      job.width = std::atoi(value.c_str());
+      ok = job.width > 0 && job.width <= MAX_JOB_RESOLUTION;
+    } else if (key == "height") {
+      job.height = std::atoi(value.c_str());
+      ok = job.height > 0 && job.height <= MAX_JOB_RESOLUTION;
+    } else if (key == "eye") {
+      ok = sscanf(value.c_str(), "%f,%f,%f", &job.eye.x, &job.eye.y, &job.eye.z) == 3 &&
+          job.eye.x < 0.f; // in front of the image plane at x = 0
+    } else if (key == "time") {
+      job.time = (float)std::atof(value.c_str());
+      ok = job.time >= 0.f && job.time <= 1.f;
+    } else if (key == "seed") {
+      job.seed = (unsigned int)std::strtoul(value.c_str(), nullptr, 10);
+    } else if (key == "irradiance_cache") {
+      job.irradiance_cache = value == "1";
+      ok = value == "0" || value == "1";
+    } else if (key == "caustic_photons") {
+      job.caustic_photons = std::atoi(value.c_str());
+      ok = job.caustic_photons >= 0 && job.caustic_photons <= MAX_JOB_CAUSTIC_PHOTONS;
+    } else if (key == "output") {
+      // Stays inside results/
+      job.output = value;
+      ok = !value.empty() && value.find("..") == std::string::npos;
+    } else {
+      error = "unknown key " + key;
+      return false;
+    }
+    if (!ok) {
+      error = "invalid " + key + " " + value;
+      return false;
+    }
+  }
+  return true;
+}
+
+RenderServer::RenderServer(std::string socket_path)
+    : socket_path_(socket_path), jobs_rendered_(0) {
+}
+
+#ifdef __unix__
+
+static bool SendLine(int fd, const std::string& line) {
+  std::string data = line + "\n";
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, 0);
+    if (n <= 0) {
+      return false;
+    }
+    sent += n;
+  }
+  return true;
+}
+
+// Reads up to the next newline into line, false at the end of the stream or
+// if the line is too long
+static bool ReceiveLine(int fd, std::string& buffer, std::string& line) {
+  size_t newline;
+  while ((newline = buffer.find('\n')) == std::string::npos) {
+    if (buffer.size() > (size_t)MAX_COMMAND_LENGTH) {
+      return false;
+    }
+    char chunk[512];
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if (n <= 0) {
+      return false;
+    }
+    buffer.append(chunk, n);
+  }
+  line = buffer.substr(0, newline);
+  buffer.erase(0, newline + 1);
+  if (!line.empty() && line.back() == '\r') {
+    line.pop_back();
+  }
+  return true;
+}
+
+static bool MakeAddress(const std::string& path, sockaddr_un& address) {
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+    return false;
+  }
+  memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  return true;
+}
+
+void RenderServer::RunJob(int fd, const RenderJob& job) {
+  auto start = std::chrono::steady_clock::now();
+  if (scene_.IsAnimated() && job.time != scene_.get_time()) {
+    scene_.SetTime(job.time);
+  }
+
+  Camera cam = Camera(job.eye, job.eye, Direction(1, 0, 0), Direction(0, 0, 1), job.width, job.height);
+  cam.ClearColorBuffer(glm::vec3(155, 45, 90));
+  cam.set_seed(job.seed);
+  cam.EnableIrradianceCache(job.irradiance_cache);
+  cam.EnableCausticPhotons(job.caustic_photons);
+  // A client that went away does not stop the render, the replies are just
+  // dropped
+  int last_percent = -1;
+  cam.set_progress_callback([fd, &last_percent](double fraction) {
+    int percent = (int)(100. * fraction);
+    if (percent != last_percent) {
+      last_percent = percent;
+      SendLine(fd, "progress " + std::to_string(percent));
+    }
+  });
+  cam.Render(scene_, job.spp);
+  jobs_rendered_++;
+
+  std::string ppm_path = cam.CreateImage("si_" + job.output, false);
+  std::string pfm_path = cam.CreateHdrImage("hdr_" + job.output);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if (ppm_path.empty() || pfm_path.empty()) {
+    SendLine(fd, "error could not write the images of " + job.output);
+    return;
+  }
+  std::cout << "\tJob " << jobs_rendered_ << ": " << job.width << "x" << job.height << ", "
+            << job.spp << " samples/pixel in " << seconds << " s" << std::endl;
+  SendLine(fd, "done " + std::to_string(seconds) + " " + ppm_path + " " + pfm_path);
+}
+
+bool RenderServer::HandleClient(int fd) {
+  std::string buffer, line;
+  while (ReceiveLine(fd, buffer, line)) {
+    std::stringstream ss(line);
+    std::string command;
+    ss >> command;
+    if (command == "render") {
+      RenderJob job;
+      std::string words, error;
+      std::getline(ss, words);
+      if (!RenderJob::Parse(words, job, error)) {
+        SendLine(fd, "error " + error);
+      } else {
+        RunJob(fd, job);
+      }
+    } else if (command == "status") {
+      SendLine(fd, "ok " + std::to_string(jobs_rendered_) + " " + std::to_string(scene_.get_time()));
+    } else if (command == "shutdown") {
+      SendLine(fd, "ok");
+      return false;
+    } else if (!command.empty()) {
+      SendLine(fd, "error unknown command " + command);
+    }
+  }
+  return true;
+}
+
+bool RenderServer::Run() {
+  sockaddr_un address;
+  if (!MakeAddress(socket_path_, address)) {
+    std::cerr << "\tInvalid socket path " << socket_path_ << std::endl;
+    return false;
+  }
+  // Writing to a client that disconnected must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+
+  // A socket left behind by a server that crashed is replaced, any other
+  // file is not
+  struct stat info;
+  if (lstat(socket_path_.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+    unlink(socket_path_.c_str());
+  }
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  // Only the user running the server may connect
+  mode_t old_mask = umask(0077);
+  bool bound = listen_fd >= 0 && bind(listen_fd, (sockaddr*)&address, sizeof(address)) == 0;
+  umask(old_mask);
+  if (!bound || listen(listen_fd, 16) != 0) {
+    std::cerr << "\tCould not listen on " << socket_path_ << ": " << strerror(errno) << std::endl;
+    if (listen_fd >= 0) {
+      close(listen_fd);
+    }
+    return false;
+  }
+  std::cout << "\tListening on " << socket_path_ << std::endl;
+
+  bool running = true;
+  while (running) {
+    int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "\tCould not accept a client: " << strerror(errno) << std::endl;
+      break;
+    }
+    running = HandleClient(fd);
+    close(fd);
+  }
+  close(listen_fd);
+  unlink(socket_path_.c_str());
+  return !running;
+}
+
+bool RenderServer::Submit(const std::string& socket_path, const std::string& command) {
+  sockaddr_un address;
+  if (!MakeAddress(socket_path, address)) {
+    std::cerr << "\tInvalid socket path " << socket_path << std::endl;
+    return false;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+    std::cerr << "\tCould not connect to " << socket_path << ": " << strerror(errno) << std::endl;
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+  bool ok = false;
+  std::string buffer, line;
+  if (SendLine(fd, command)) {
+    while (ReceiveLine(fd, buffer, line)) {
+      std::cout << line << std::endl;
+      if (line.compare(0, 8, "progress") != 0) {
+        ok = line.compare(0, 5, "error") != 0;
+        break;
+      }
+    }
+  }
+  close(fd);
+  return ok;
+}
+
+#else
+
+bool RenderServer::Run() {
+  std::cerr << "\tThe render server is only supported on UNIX systems" << std::endl;
+  return false;
+}
+
+bool RenderServer::Submit(const std::string& socket_path, const std::string& command) {
+  std::cerr << "\tThe render server is only supported on UNIX systems" << std::endl;
+  return false;
+}
+
+#endif
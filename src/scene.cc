@@ -1,13 +1,160 @@
+#define _USE_MATH_DEFINES // Needed to run in windows/visual studio
 #include "scene.h"
 #include "commons.h"
 #include "tetrahedron.h"
+#include "instance.h"
+#include "ray.h"
 #include "point_light.h"
 #include "sphere.h"
+#include <atomic>
+#include <cmath>
 
-Scene::Scene() {
+// Rebuild the top level BVH when refitting made it this much more expensive
+const float BVH_REBUILD_COST_RATIO = 1.5f;
+
+// A grid only pays off for many objects. Their sizes (box diagonals) may
+// vary this much, standard deviation over mean, since a large object is
+// listed in many cells. And they have to be spread out: in a coarse grid
+// with about 8 objects per cell at least this fraction of the cells is used
+const int GRID_MIN_OBJECTS = 256;
+const float GRID_MAX_SIZE_VARIATION = 0.5f;
+const float GRID_MIN_OCCUPANCY = 0.5f;
+
+// Versions are never reused, not even by another scene at the same address
+static int NextVersion() {
+  static std::atomic<int> next_version(0);
+  return next_version++;
+}
+
+Scene::Scene(SceneAccelerator accelerator /* = ACCELERATOR_AUTO */)
+    : accelerator_(accelerator), use_grid_(false), bvh_build_cost_(0.f), version_(NextVersion()) {
   InitObjects();
   InitRoom();
   InitLights();
+  use_grid_ = accelerator_ == ACCELERATOR_GRID ||
+      (accelerator_ == ACCELERATOR_AUTO && PreferGrid(GetObjectBounds()));
+  BuildAccelerator();
+}
+
+Scene::Scene(SceneAccelerator accelerator, bool use_grid)
+    : accelerator_(accelerator), use_grid_(use_grid), bvh_build_cost_(0.f), version_(0) {
+}
+
+std::unique_ptr<Scene> Scene::Clone() const {
+  std::unique_ptr<Scene> copy(new Scene(accelerator_, use_grid_));
+  MeshCopies meshes;
+  for (Mesh* mesh : meshes_) {
+    copy->meshes_.push_back(mesh->Clone(copy->arena_));
+    meshes[mesh] = copy->meshes_.back();
+  }
+  std::unordered_map<const SceneObject*, SceneObject*> objects;
+  for (SceneObject* object : scene_objects_) {
+    copy->scene_objects_.push_back(object->Clone(copy->arena_, meshes));
+    objects[object] = copy->scene_objects_.back();
+  }
+  for (Light* light : scene_lights_) {
+    copy->scene_lights_.push_back(light->Clone(copy->arena_, meshes));
+  }
+  for (const AnimatedObject& animated : animated_objects_) {
+    copy->animated_objects_.push_back({ objects.at(animated.object), animated.animation });
+  }
+  // Same objects in the same order, so the object indices still hold
+  copy->bvh_ = bvh_;
+  copy->bvh_build_cost_ = bvh_build_cost_;
+  copy->grid_ = grid_;
+  copy->time_ = time_;
+  copy->version_ = version_;
+  return copy;
+}
+
+bool Scene::PreferGrid(const std::vector<Aabb>& object_bounds) {
+  if ((int)object_bounds.size() < GRID_MIN_OBJECTS) {
+    return false;
+  }
+  double sum = 0.;
+  double sum_squares = 0.;
+  for (const Aabb& box : object_bounds) {
+    double size = glm::length(box.max - box.min);
+    sum += size;
+    sum_squares += size * size;
+  }
+  double mean = sum / object_bounds.size();
+  double variance = std::max(0., sum_squares / object_bounds.size() - mean * mean);
+  if (mean <= 0. || sqrt(variance) > GRID_MAX_SIZE_VARIATION * mean) {
+    return false;
+  }
+  Grid coarse;
+  coarse.Build(object_bounds, 1.f / 8.f);
+  return coarse.GetOccupancy() >= GRID_MIN_OCCUPANCY;
+}
+
+std::vector<Aabb> Scene::GetObjectBounds() {
+  std::vector<Aabb> bounds;
+  for (auto& object : scene_objects_) {
+    bounds.push_back(object->GetBounds());
+  }
+  return bounds;
+}
+
+void Scene::BuildAccelerator() {
+  if (use_grid_) {
+    grid_.Build(GetObjectBounds());
+    return;
+  }
+  bvh_.Build(GetObjectBounds());
+  bvh_build_cost_ = bvh_.ComputeSahCost();
+}
+
+bool Scene::SetTime(float time) {
+  time_ = time;
+  version_ = NextVersion();
+  for (AnimatedObject& animated : animated_objects_) {
+    animated.object->set_transform(animated.animation.Evaluate(time));
+  }
+  if (use_grid_) {
+    BuildAccelerator();
+    return true;
+  }
+  bvh_.Refit(GetObjectBounds());
+  if (bvh_.ComputeSahCost() <= BVH_REBUILD_COST_RATIO * bvh_build_cost_) {
+    return false;
+  }
+  BuildAccelerator();
+  return true;
+}
+
+IntersectionPoint* Scene::ClosestIntersection(Ray& ray, Arena& scratch) {
+  IntersectionPoint* closest = nullptr;
+  float t_max = FLT_MAX;
+  auto intersect = [&](int object, float& t) {
+    IntersectionPoint* p = scene_objects_[object]->RayIntersection(ray, scratch);
+    if (p && p->get_z() < t) {
+      t = p->get_z();
+      closest = p;
+    }
+    return false;
+  };
+  if (use_grid_) {
+    grid_.Traverse(ray.get_origin(), ray.get_direction(), t_max, intersect);
+  } else {
+    bvh_.Traverse(ray.get_origin(), ray.get_direction(), t_max, intersect);
+  }
+  return closest;
+}
+
+bool Scene::Occluded(Ray& ray, float max_distance, Arena& scratch, bool glass_casts_shadows /* = false */) {
+  bool occluded = false;
+  auto intersect = [&](int object, float& t) {
+    IntersectionPoint* p = scene_objects_[object]->RayIntersection(ray, scratch);
+    occluded = p && p->get_z() < t && (glass_casts_shadows || p->get_material().get_transparence() == 0.f);
+    return occluded;
+  };
+  if (use_grid_) {
+    grid_.Traverse(ray.get_origin(), ray.get_direction(), max_distance, intersect);
+  } else {
+    bvh_.Traverse(ray.get_origin(), ray.get_direction(), max_distance, intersect);
+  }
+  return occluded;
 }
 
 void Scene::InitObjects() {
@@ -16,23 +163,32 @@ void Scene::InitObjects() {
   Vertex v2 = Vertex(10 - 6,  6 - 7, -2);
   Vertex v3 = Vertex( 9 - 6,  4.5f - 7.f,  1);
 
-  // Bottom
-  /*Triangle t0 = Triangle(v0, v2, v1, tetra1_mat);
-  // Sides
-  Triangle t1 = Triangle(v0, v1, v3, tetra1_mat); // "front"
-  Triangle t2 = Triangle(v1, v2, v3, tetra1_mat); // "back"
-  Triangle t3 = Triangle(v0, v3, v2, ColorDbl(100,100,100)); // "left side"*/
+  //meshes_.push_back(arena_.Create<Tetrahedron>(3.f, 3.5f, Vertex(0, 0, 0), GLASS_MAT));
+  //scene_objects_.push_back(arena_.Create<Instance>(meshes_.back(), glm::translate(glm::mat4(1.f), Vertex(6, -2.f,-3.5f))));
+
+  Material tetra_mat = Material(1,0,0, COLOR_BLUE, glm::vec3(0,0,0));
+  Triangle t0 = Triangle(v0, v2, v1, tetra_mat); // bottom
+  Triangle t1 = Triangle(v0, v1, v3, tetra_mat); // "front"
+  Triangle t2 = Triangle(v1, v2, v3, tetra_mat); // "back"
+  Triangle t3 = Triangle(v0, v3, v2, tetra_mat); // "left side"
+  meshes_.push_back(arena_.Create<Tetrahedron>(t0, t1, t2, t3));
+  scene_objects_.push_back(arena_.Create<Instance>(meshes_.back(), glm::mat4(1.f)));
 
-  // scene_objects_.push_back(std::make_unique<Tetrahedron>(t0, t1, t2, t3));
-  //scene_objects_.push_back(std::make_unique<Tetrahedron>(3.f, 3.5f, Vertex(6, -2.f,-3.5f), GLASS_MAT));
+  // One turn on the spot over the animation
+  Animation spin = Animation((v0 + v1 + v2 + v3) / 4.f);
+  spin.AddKeyframe(0.f, Direction(0, 0, 0), 0.f, 1.f);
+  spin.AddKeyframe(1.f, Direction(0, 0, 0), 2 * (float)M_PI, 1.f);
+  animated_objects_.push_back({ scene_objects_.back(), spin });
 
-  scene_objects_.push_back(std::make_unique<Triangle>(v0, v2, v1, Material(1,0,0, COLOR_BLUE, glm::vec3(0,0,0))));
-  scene_objects_.push_back(std::make_unique<Triangle>(v0, v1, v3, Material(1,0,0, COLOR_BLUE, glm::vec3(0,0,0))));
-  scene_objects_.push_back(std::make_unique<Triangle>(v1, v2, v3, Material(1,0,0, COLOR_BLUE, glm::vec3(0,0,0))));
-  scene_objects_.push_back(std::make_unique<Triangle>(v0, v3, v2, Material(1,0,0, COLOR_BLUE, glm::vec3(0,0,0))));
+  //scene_objects_.push_back(arena_.Create<Sphere>(Vertex(6.f, -0.2f, 3.f), 1.0f, GLASS_MAT));
+  scene_objects_.push_back(arena_.Create<Sphere>(Vertex(5.f, 2.5f, -2.5f), 1.6f, PERFECT_MIRROR));
 
-  //scene_objects_.push_back(std::make_unique<Sphere>(Vertex(6.f, -0.2f, 3.f), 1.0f, GLASS_MAT));
-  scene_objects_.push_back(std::make_unique<Sphere>(Vertex(5.f, 2.5f, -2.5f), 1.6f, PERFECT_MIRROR));
+  // Up into the room and back down again
+  Animation bounce = Animation(Vertex(5.f, 2.5f, -2.5f));
+  bounce.AddKeyframe(0.f, Direction(0, 0, 0), 0.f, 1.f);
+  bounce.AddKeyframe(0.5f, Direction(2, -3, 4), 0.f, 0.8f);
+  bounce.AddKeyframe(1.f, Direction(0, 0, 0), 0.f, 1.f);
+  animated_objects_.push_back({ scene_objects_.back(), bounce });
 }
 
 void Scene::InitRoom() {
@@ -69,49 +225,49 @@ void Scene::InitRoom() {
   //std::vector<Triangle> triangle_list;
 
   // Floor
-  scene_objects_.push_back(std::make_unique<Triangle>(vfC, vf6, vf1, floor_mat));
-  scene_objects_.push_back(std::make_unique<Triangle>(vfC, vf1, vf2, floor_mat));
-  scene_objects_.push_back(std::make_unique<Triangle>(vfC, vf2, vf3, floor_mat));
-  scene_objects_.push_back(std::make_unique<Triangle>(vfC, vf3, vf4, floor_mat));
-  scene_objects_.push_back(std::make_unique<Triangle>(vfC, vf4, vf5, floor_mat));
-  scene_objects_.push_back(std::make_unique<Triangle>(vfC, vf5, vf6, floor_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vfC, vf6, vf1, floor_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vfC, vf1, vf2, floor_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vfC, vf2, vf3, floor_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vfC, vf3, vf4, floor_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vfC, vf4, vf5, floor_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vfC, vf5, vf6, floor_mat));
 
   // Ceiling
-  scene_objects_.push_back(std::make_unique<Triangle>(vcC, vc1, vc6, ceiling_mat));
-  scene_objects_.push_back(std::make_unique<Triangle>(vcC, vc2, vc1, ceiling_mat));
-  scene_objects_.push_back(std::make_unique<Triangle>(vcC, vc3, vc2, ceiling_mat));
-  scene_objects_.push_back(std::make_unique<Triangle>(vcC, vc4, vc3, ceiling_mat));
-  scene_objects_.push_back(std::make_unique<Triangle>(vcC, vc5, vc4, ceiling_mat));
-  scene_objects_.push_back(std::make_unique<Triangle>(vcC, vc6, vc5, ceiling_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vcC, vc1, vc6, ceiling_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vcC, vc2, vc1, ceiling_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vcC, vc3, vc2, ceiling_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vcC, vc4, vc3, ceiling_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vcC, vc5, vc4, ceiling_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vcC, vc6, vc5, ceiling_mat));
 
   /* Counter-clockwise order, starting with front */
 
   // Wall1
-  scene_objects_.push_back(std::make_unique<Triangle>(vf2, vc2, vf3, wall1_mat));
-  scene_objects_.push_back(std::make_unique<Triangle>(vf3, vc2, vc3, wall1_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vf2, vc2, vf3, wall1_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vf3, vc2, vc3, wall1_mat));
 
   // Wall 2
-  scene_objects_.push_back(std::make_unique<Triangle>(vf3, vc3, vf4, wall2b_mat));
-  scene_objects_.push_back(std::make_unique<Triangle>(vf4, vc3, vc4, wall2a_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vf3, vc3, vf4, wall2b_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vf4, vc3, vc4, wall2a_mat));
 
   // Wall 3
-  scene_objects_.push_back(std::make_unique<Triangle>(vf4, vc4, vf5, wall3_mat));
-  scene_objects_.push_back(std::make_unique<Triangle>(vf5, vc4, vc5, wall3_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vf4, vc4, vf5, wall3_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vf5, vc4, vc5, wall3_mat));
 
   // Wall 4
-  scene_objects_.push_back(std::make_unique<Triangle>(vf5, vc5, vf6, wall4_mat));
-  scene_objects_.push_back(std::make_unique<Triangle>(vf6, vc5, vc6, wall4_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vf5, vc5, vf6, wall4_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vf6, vc5, vc6, wall4_mat));
 
   // Wall 5
-  scene_objects_.push_back(std::make_unique<Triangle>(vf6, vc6, vf1, wall5_mat));
-  scene_objects_.push_back(std::make_unique<Triangle>(vf1, vc6, vc1, wall5_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vf6, vc6, vf1, wall5_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vf1, vc6, vc1, wall5_mat));
 
   // Wall 6
-  scene_objects_.push_back(std::make_unique<Triangle>(vf1, vc1, vf2, wall6_mat));
-  scene_objects_.push_back(std::make_unique<Triangle>(vf2, vc1, vc2, wall6_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vf1, vc1, vf2, wall6_mat));
+  scene_objects_.push_back(arena_.Create<Triangle>(vf2, vc1, vc2, wall6_mat));
 }
 
 void Scene::InitLights() {
-  scene_lights_.push_back(std::make_unique<PointLight>(Vertex(5.f,0.f,4.5f), 1.f, COLOR_WHITE));
-  //scene_lights_.push_back(std::make_unique<PointLight>(Vertex(5.f,0.f,-3.5f), 100.f, COLOR_WHITE));
+  scene_lights_.push_back(arena_.Create<PointLight>(Vertex(5.f,0.f,4.5f), 1.f, COLOR_WHITE));
+  //scene_lights_.push_back(arena_.Create<PointLight>(Vertex(5.f,0.f,-3.5f), 100.f, COLOR_WHITE));
 }